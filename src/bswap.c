@@ -0,0 +1,79 @@
+#include "bswap.h"
+
+#include <string.h>
+
+// the SSSE3 kernel is compiled regardless of build flags, and selected at runtime.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define BSWAP_SIMD 1
+#define BSWAP_SIMD_TARGET __attribute__((target("ssse3")))
+#define BSWAP_SIMD_SUPPORTED() __builtin_cpu_supports("ssse3")
+#endif
+
+#define DEFINE_BSWAP_ARRAY(bits) \
+static void bswap##bits##_array(char* data, size_t count) \
+{ \
+    for (size_t i = 0; i < count; ++i, data += sizeof(uint##bits##_t)) \
+    { \
+        uint##bits##_t v; \
+        memcpy(&v, data, sizeof(v)); \
+        v = retro_script_bswap##bits(v); \
+        memcpy(data, &v, sizeof(v)); \
+    } \
+}
+
+DEFINE_BSWAP_ARRAY(16)
+DEFINE_BSWAP_ARRAY(32)
+DEFINE_BSWAP_ARRAY(64)
+
+#if BSWAP_SIMD
+// swaps 16 bytes at a time, returning the number of elements left over.
+BSWAP_SIMD_TARGET static size_t bswap_array_simd(char* data, size_t size, size_t count)
+{
+    static const char shuffle16[16] = { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 };
+    static const char shuffle32[16] = { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 };
+    static const char shuffle64[16] = { 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 };
+    
+    const char* shuffle = (size == 2) ? shuffle16 : (size == 4) ? shuffle32 : shuffle64;
+    const __m128i mask = _mm_loadu_si128((const __m128i*)shuffle);
+    
+    const size_t per_block = 16 / size;
+    const size_t blocks = count / per_block;
+    for (size_t i = 0; i < blocks; ++i, data += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)data);
+        _mm_storeu_si128((__m128i*)data, _mm_shuffle_epi8(v, mask));
+    }
+    
+    return count - blocks * per_block;
+}
+#endif
+
+void retro_script_bswap_array(void* vdata, size_t size, size_t count)
+{
+    char* data = (char*)vdata;
+    
+    #if BSWAP_SIMD
+    if ((size == 2 || size == 4 || size == 8) && BSWAP_SIMD_SUPPORTED())
+    {
+        const size_t remaining = bswap_array_simd(data, size, count);
+        data += (count - remaining) * size;
+        count = remaining;
+    }
+    #endif
+    
+    switch (size)
+    {
+    case 2:
+        bswap16_array(data, count);
+        break;
+    case 4:
+        bswap32_array(data, count);
+        break;
+    case 8:
+        bswap64_array(data, count);
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+/* byte-order utilities.
+ */
+
+#include "util.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if IC_COMPILER_MSC
+#define __BYTE_ORDER__ 4321
+#define __ORDER_BIG_ENDIAN__ 4321
+#define __ORDER_LITTLE_ENDIAN__ 1234
+#endif
+
+#ifndef SYS_IS_BIGENDIAN
+#define SYS_IS_BIGENDIAN (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#endif
+
+#if defined(_MSC_VER)
+    #include <stdlib.h>
+    #define retro_script_bswap16(x) _byteswap_ushort(x)
+    #define retro_script_bswap32(x) _byteswap_ulong(x)
+    #define retro_script_bswap64(x) _byteswap_uint64(x)
+#elif defined(__GNUC__) || defined(__clang__)
+    #define retro_script_bswap16(x) __builtin_bswap16(x)
+    #define retro_script_bswap32(x) __builtin_bswap32(x)
+    #define retro_script_bswap64(x) __builtin_bswap64(x)
+#else
+    #define retro_script_bswap16(x) ((uint16_t)(((uint16_t)(x) >> 8) | ((uint16_t)(x) << 8)))
+    #define retro_script_bswap32(x) \
+        ((((uint32_t)(x) & 0xff000000u) >> 24) | (((uint32_t)(x) & 0x00ff0000u) >> 8) | \
+         (((uint32_t)(x) & 0x0000ff00u) << 8) | (((uint32_t)(x) & 0x000000ffu) << 24))
+    #define retro_script_bswap64(x) \
+        (((uint64_t)retro_script_bswap32((uint32_t)(x)) << 32) | retro_script_bswap32((uint32_t)((uint64_t)(x) >> 32)))
+#endif
+
+// reverses the byte order of a single value of the given size (1, 2, 4, or 8) in place.
+static FORCEINLINE void retro_script_bswap_value(void* data, size_t size)
+{
+    #define SWAP(bits) { uint##bits##_t v; memcpy(&v, data, sizeof(v)); v = retro_script_bswap##bits(v); memcpy(data, &v, sizeof(v)); break; }
+    switch (size)
+    {
+    case 2: SWAP(16);
+    case 4: SWAP(32);
+    case 8: SWAP(64);
+    default: break;
+    }
+    #undef SWAP
+}
+
+// reverses the byte order of each of `count` consecutive elements of the given size (1, 2, 4, or 8) in place.
+// data need not be aligned.
+void retro_script_bswap_array(void* data, size_t size, size_t count);
@@ -46,6 +46,9 @@ extern struct frontend_callbacks_t
 } retro_script_callbacks;
 #define frontend_callbacks retro_script_callbacks
 
+// set once the core provides its own memory map (rather than the one synthesized from retro_get_memory_data).
+extern bool retro_script_memory_map_from_core;
+
 typedef void (*core_init_cb_t)();
 
 // attach a function that runs once every time a new core is created/destroyed
@@ -50,7 +50,7 @@ void* retro_script_hashmap_add(struct retro_script_hashmap* map, size_t index)
     
     // insert into list
     *(size_t*)&new_entry->index = index;
-    new_entry->next = *entry ? (*entry)->next : NULL;
+    new_entry->next = *entry;
     *entry = new_entry;
     
     return ((char*)new_entry) + sizeof(hashmap_entry_header);
@@ -77,7 +77,7 @@ void* retro_script_hashmap_get(struct retro_script_hashmap const* map, size_t in
 
 int retro_script_hashmap_remove(struct retro_script_hashmap* map, size_t index)
 {
-    hashmap_entry_header** entry = &map->table[index * HASHTABLE_SIZE];
+    hashmap_entry_header** entry = &map->table[index % HASHTABLE_SIZE];
     while (*entry)
     {
         if ((*entry)->index == index)
@@ -103,6 +103,17 @@ REMOVE:
     }
 }
 
+void retro_script_hashmap_foreach(struct retro_script_hashmap* map, void (*fn)(size_t index, void* data))
+{
+    for (size_t i = 0; i < HASHTABLE_SIZE; ++i)
+    {
+        for (hashmap_entry_header* entry = map->table[i]; entry; entry = entry->next)
+        {
+            fn(entry->index, ((char*)entry) + sizeof(*entry));
+        }
+    }
+}
+
 void retro_script_hashmap_destroy(struct retro_script_hashmap* map)
 {
     for (size_t i = 0; i < HASHTABLE_SIZE; ++i)
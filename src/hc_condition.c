@@ -0,0 +1,503 @@
+#include "hc_condition.h"
+#include "hc_registers.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// the deepest that the evaluation stack may get; more deeply nested conditions are rejected when compiled.
+#define CONDITION_STACK_SIZE 32
+
+// limits recursion while parsing.
+#define CONDITION_MAX_NESTING 64
+
+#define CONDITION_MAX_IDENTIFIER 32
+
+typedef enum condition_op
+{
+    OP_CONST,
+    OP_VALUE,
+    OP_ADDRESS,
+    OP_OPERATION,
+    OP_REGISTER, // arg is the register's index.
+    OP_PEEK,
+    OP_NOT,
+    OP_COMPL,
+    OP_NEG,
+    OP_BOOL,
+    
+    // if the top of the stack is 0 (or nonzero, respectively), jumps to arg, keeping it; otherwise pops it.
+    OP_JUMP_IF_FALSE,
+    OP_JUMP_IF_TRUE,
+    
+    // pop two operands, push the result.
+    OP_OR,
+    OP_XOR,
+    OP_AND,
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_SHL,
+    OP_SHR,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+} condition_op_t;
+
+typedef struct condition_instruction
+{
+    uint32_t op;
+    int64_t arg;
+} condition_instruction_t;
+
+struct retro_script_hc_condition
+{
+    hc_Cpu const* cpu;
+    hc_Memory const* memory;
+    condition_instruction_t* code;
+    size_t num_instructions;
+};
+
+typedef struct binary_operator
+{
+    const char* token;
+    int precedence;
+    condition_op_t op; // (&& and || are compiled to jumps.)
+} binary_operator_t;
+
+// as in C. Longer tokens come first, so that they are matched before their prefixes.
+static const binary_operator_t binary_operators[] = {
+    { "||", 1, OP_JUMP_IF_TRUE },
+    { "&&", 2, OP_JUMP_IF_FALSE },
+    { "<<", 8, OP_SHL },
+    { ">>", 8, OP_SHR },
+    { "<=", 7, OP_LE },
+    { ">=", 7, OP_GE },
+    { "==", 6, OP_EQ },
+    { "!=", 6, OP_NE },
+    { "|", 3, OP_OR },
+    { "^", 4, OP_XOR },
+    { "&", 5, OP_AND },
+    { "<", 7, OP_LT },
+    { ">", 7, OP_GT },
+    { "+", 9, OP_ADD },
+    { "-", 9, OP_SUB },
+    { "*", 10, OP_MUL },
+    { "/", 10, OP_DIV },
+    { "%", 10, OP_MOD },
+};
+
+typedef struct compiler
+{
+    const char* source;
+    const char* p;
+    hc_Cpu const* cpu;
+    hc_Memory const* memory;
+    
+    condition_instruction_t* code;
+    size_t num_instructions;
+    size_t capacity;
+    
+    // of the evaluation stack after the instructions emitted so far.
+    int depth;
+    int max_depth;
+    int nesting;
+    
+    char* error;
+    size_t error_size;
+    bool failed;
+} compiler_t;
+
+static void fail(compiler_t* c, const char* message)
+{
+    if (c->failed) return;
+    c->failed = true;
+    if (c->error && c->error_size)
+    {
+        snprintf(c->error, c->error_size, "%s (at column %d)", message, (int)(c->p - c->source) + 1);
+    }
+}
+
+// effect is the change in the depth of the evaluation stack.
+// returns the index of the instruction.
+static size_t emit(compiler_t* c, condition_op_t op, int64_t arg, int effect)
+{
+    if (c->failed) return 0;
+    if (c->num_instructions >= c->capacity)
+    {
+        const size_t capacity = c->capacity ? c->capacity * 2 : 16;
+        condition_instruction_t* resized = (condition_instruction_t*)realloc(c->code, sizeof(condition_instruction_t) * capacity);
+        if (!resized)
+        {
+            fail(c, "unable to allocate condition");
+            return 0;
+        }
+        c->code = resized;
+        c->capacity = capacity;
+    }
+    
+    c->code[c->num_instructions].op = op;
+    c->code[c->num_instructions].arg = arg;
+    
+    c->depth += effect;
+    if (c->depth > c->max_depth) c->max_depth = c->depth;
+    return c->num_instructions++;
+}
+
+static void skip_space(compiler_t* c)
+{
+    while (*c->p == ' ' || *c->p == '\t' || *c->p == '\n' || *c->p == '\r') ++c->p;
+}
+
+static bool is_identifier_char(char ch, bool first)
+{
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_' || (!first && ch >= '0' && ch <= '9');
+}
+
+static bool equals_ignore_case(const char* a, const char* b)
+{
+    for (; *a && *b; ++a, ++b)
+    {
+        char ca = (*a >= 'A' && *a <= 'Z') ? *a - 'A' + 'a' : *a;
+        char cb = (*b >= 'A' && *b <= 'Z') ? *b - 'A' + 'a' : *b;
+        if (ca != cb) return false;
+    }
+    return *a == *b;
+}
+
+// returns -1 if the cpu has no such register.
+static int find_register(compiler_t* c, const char* name)
+{
+    if (!c->cpu) return -1;
+    const int num_registers = retro_script_hc_get_cpu_register_count(c->cpu->v1.type);
+    
+    // (an exact match takes precedence.)
+    int found = -1;
+    for (int i = 0; i < num_registers; ++i)
+    {
+        const char* register_name = retro_script_hc_get_cpu_register_name(c->cpu->v1.type, i);
+        if (!register_name) continue;
+        if (!strcmp(register_name, name)) return i;
+        if (found < 0 && equals_ignore_case(register_name, name)) found = i;
+    }
+    return found;
+}
+
+static void parse_expression(compiler_t* c, int min_precedence);
+
+static void parse_number(compiler_t* c)
+{
+    const char* p = c->p;
+    int base = 10;
+    if (p[0] == '$')
+    {
+        base = 16;
+        p += 1;
+    }
+    else if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+    {
+        base = 16;
+        p += 2;
+    }
+    else if (p[0] == '0' && (p[1] == 'b' || p[1] == 'B'))
+    {
+        base = 2;
+        p += 2;
+    }
+    
+    // (strtoull would also accept leading whitespace and a sign.)
+    const char digit = (*p >= 'A' && *p <= 'Z') ? *p - 'A' + 'a' : *p;
+    const bool is_digit = base == 2
+        ? (digit == '0' || digit == '1')
+        : (digit >= '0' && digit <= '9') || (base == 16 && digit >= 'a' && digit <= 'f');
+    if (!is_digit)
+    {
+        fail(c, "invalid number");
+        return;
+    }
+    
+    char* end;
+    errno = 0;
+    const uint64_t n = strtoull(p, &end, base);
+    if (errno == ERANGE)
+    {
+        fail(c, "number is out of range");
+        return;
+    }
+    if (end == p || *end == '.' || is_identifier_char(*end, false))
+    {
+        fail(c, "invalid number");
+        return;
+    }
+    c->p = end;
+    emit(c, OP_CONST, (int64_t)n, 1);
+}
+
+static void parse_identifier(compiler_t* c)
+{
+    const char* begin = c->p;
+    while (is_identifier_char(*c->p, c->p == begin)) ++c->p;
+    
+    char name[CONDITION_MAX_IDENTIFIER];
+    const size_t len = c->p - begin;
+    if (len >= sizeof(name))
+    {
+        c->p = begin;
+        fail(c, "unknown identifier");
+        return;
+    }
+    memcpy(name, begin, len);
+    name[len] = 0;
+    
+    if (!strcmp(name, "value"))
+    {
+        emit(c, OP_VALUE, 0, 1);
+    }
+    else if (!strcmp(name, "address"))
+    {
+        emit(c, OP_ADDRESS, 0, 1);
+    }
+    else if (!strcmp(name, "operation"))
+    {
+        emit(c, OP_OPERATION, 0, 1);
+    }
+    else
+    {
+        const int reg = find_register(c, name);
+        if (reg < 0 || !c->cpu->v1.get_register)
+        {
+            c->p = begin;
+            fail(c, reg < 0 ? "unknown identifier" : "registers cannot be read");
+            return;
+        }
+        emit(c, OP_REGISTER, reg, 1);
+    }
+}
+
+// parses the expression, and then expects the closing character.
+static void parse_enclosed(compiler_t* c, char close)
+{
+    ++c->p;
+    parse_expression(c, 1);
+    if (c->failed) return;
+    skip_space(c);
+    if (*c->p != close)
+    {
+        fail(c, close == ')' ? "expected ')'" : "expected ']'");
+        return;
+    }
+    ++c->p;
+}
+
+static void parse_unary(compiler_t* c)
+{
+    if (++c->nesting > CONDITION_MAX_NESTING)
+    {
+        fail(c, "condition is nested too deeply");
+        return;
+    }
+    
+    skip_space(c);
+    const char ch = *c->p;
+    if (ch == '!' || ch == '~' || ch == '-' || ch == '+')
+    {
+        ++c->p;
+        parse_unary(c);
+        if (ch == '!') emit(c, OP_NOT, 0, 0);
+        if (ch == '~') emit(c, OP_COMPL, 0, 0);
+        if (ch == '-') emit(c, OP_NEG, 0, 0);
+    }
+    else if (ch == '(')
+    {
+        parse_enclosed(c, ')');
+    }
+    else if (ch == '[')
+    {
+        if (!c->memory || !c->memory->v1.peek)
+        {
+            fail(c, "memory cannot be read");
+            return;
+        }
+        parse_enclosed(c, ']');
+        emit(c, OP_PEEK, 0, 0);
+    }
+    else if (ch == '$' || (ch >= '0' && ch <= '9'))
+    {
+        parse_number(c);
+    }
+    else if (is_identifier_char(ch, true))
+    {
+        parse_identifier(c);
+    }
+    else
+    {
+        fail(c, ch ? "expected an operand" : "unexpected end of condition");
+    }
+    
+    --c->nesting;
+}
+
+static binary_operator_t const* peek_binary_operator(compiler_t* c)
+{
+    skip_space(c);
+    for (size_t i = 0; i < sizeof(binary_operators) / sizeof(binary_operators[0]); ++i)
+    {
+        const char* token = binary_operators[i].token;
+        if (!strncmp(c->p, token, strlen(token))) return &binary_operators[i];
+    }
+    return NULL;
+}
+
+// precedence climbing: parses operands joined by binary operators of at least the given precedence.
+static void parse_expression(compiler_t* c, int min_precedence)
+{
+    parse_unary(c);
+    while (!c->failed)
+    {
+        binary_operator_t const* op = peek_binary_operator(c);
+        if (!op || op->precedence < min_precedence) break;
+        c->p += strlen(op->token);
+        
+        if (op->op == OP_JUMP_IF_FALSE || op->op == OP_JUMP_IF_TRUE)
+        {
+            // the result is 0 or 1; the right side is only evaluated if the left does not decide it.
+            emit(c, OP_BOOL, 0, 0);
+            const size_t jump = emit(c, op->op, 0, -1);
+            parse_expression(c, op->precedence + 1);
+            emit(c, OP_BOOL, 0, 0);
+            if (!c->failed) c->code[jump].arg = c->num_instructions;
+        }
+        else
+        {
+            parse_expression(c, op->precedence + 1);
+            emit(c, op->op, 0, -1);
+        }
+    }
+}
+
+retro_script_hc_condition_t* retro_script_hc_condition_compile(const char* source, hc_Cpu const* cpu, hc_Memory const* memory, char* error, size_t error_size)
+{
+    compiler_t c;
+    memset(&c, 0, sizeof(c));
+    c.source = source;
+    c.p = source;
+    c.cpu = cpu;
+    c.memory = memory;
+    c.error = error;
+    c.error_size = error_size;
+    
+    parse_expression(&c, 1);
+    skip_space(&c);
+    if (*c.p) fail(&c, "unexpected character");
+    if (c.max_depth > CONDITION_STACK_SIZE) fail(&c, "condition is nested too deeply");
+    
+    retro_script_hc_condition_t* condition = NULL;
+    if (!c.failed)
+    {
+        condition = alloc(retro_script_hc_condition_t);
+        if (!condition) fail(&c, "unable to allocate condition");
+    }
+    if (c.failed)
+    {
+        if (c.code) free(c.code);
+        return NULL;
+    }
+    
+    condition->cpu = cpu;
+    condition->memory = memory;
+    condition->code = c.code;
+    condition->num_instructions = c.num_instructions;
+    return condition;
+}
+
+bool retro_script_hc_condition_eval(retro_script_hc_condition_t const* condition, hc_Event const* e)
+{
+    int64_t value = 0, address = 0, operation = 0;
+    switch (e->type)
+    {
+    case HC_EVENT_EXECUTION:
+        address = e->execution.address;
+        break;
+    case HC_EVENT_MEMORY:
+        address = e->memory.address;
+        operation = e->memory.operation;
+        value = e->memory.value;
+        break;
+    case HC_EVENT_REG:
+        address = e->reg.reg;
+        value = e->reg.new_value;
+        break;
+    default:
+        break;
+    }
+    
+    // (signed overflow is avoided by wrapping arithmetic as unsigned.)
+    #define BINARY(op, expr) \
+        case op: \
+        { \
+            const int64_t a = stack[top - 1], b = stack[top]; \
+            stack[--top] = (expr); \
+        } \
+        break
+    
+    int64_t stack[CONDITION_STACK_SIZE];
+    int top = -1;
+    condition_instruction_t const* code = condition->code;
+    for (size_t i = 0; i < condition->num_instructions; ++i)
+    {
+        switch (code[i].op)
+        {
+        case OP_CONST: stack[++top] = code[i].arg; break;
+        case OP_VALUE: stack[++top] = value; break;
+        case OP_ADDRESS: stack[++top] = address; break;
+        case OP_OPERATION: stack[++top] = operation; break;
+        case OP_REGISTER: stack[++top] = (int64_t)condition->cpu->v1.get_register((unsigned)code[i].arg); break;
+        case OP_PEEK: stack[top] = condition->memory->v1.peek((uint64_t)stack[top]); break;
+        case OP_NOT: stack[top] = !stack[top]; break;
+        case OP_COMPL: stack[top] = ~stack[top]; break;
+        case OP_NEG: stack[top] = (int64_t)(0 - (uint64_t)stack[top]); break;
+        case OP_BOOL: stack[top] = !!stack[top]; break;
+        case OP_JUMP_IF_FALSE:
+            if (!stack[top]) i = code[i].arg - 1;
+            else --top;
+            break;
+        case OP_JUMP_IF_TRUE:
+            if (stack[top]) i = code[i].arg - 1;
+            else --top;
+            break;
+        BINARY(OP_OR, a | b);
+        BINARY(OP_XOR, a ^ b);
+        BINARY(OP_AND, a & b);
+        BINARY(OP_EQ, a == b);
+        BINARY(OP_NE, a != b);
+        BINARY(OP_LT, a < b);
+        BINARY(OP_LE, a <= b);
+        BINARY(OP_GT, a > b);
+        BINARY(OP_GE, a >= b);
+        BINARY(OP_SHL, (b >= 0 && b < 64) ? (int64_t)((uint64_t)a << b) : 0);
+        BINARY(OP_SHR, (b >= 0 && b < 64) ? (int64_t)((uint64_t)a >> b) : 0);
+        BINARY(OP_ADD, (int64_t)((uint64_t)a + (uint64_t)b));
+        BINARY(OP_SUB, (int64_t)((uint64_t)a - (uint64_t)b));
+        BINARY(OP_MUL, (int64_t)((uint64_t)a * (uint64_t)b));
+        BINARY(OP_DIV, b == 0 ? 0 : b == -1 ? (int64_t)(0 - (uint64_t)a) : a / b);
+        BINARY(OP_MOD, (b == 0 || b == -1) ? 0 : a % b);
+        }
+    }
+    
+    #undef BINARY
+    
+    return top >= 0 && stack[top] != 0;
+}
+
+void retro_script_hc_condition_free(retro_script_hc_condition_t* condition)
+{
+    if (!condition) return;
+    if (condition->code) free(condition->code);
+    free(condition);
+}
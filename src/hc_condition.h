@@ -0,0 +1,31 @@
+#pragma once
+
+/* conditions on hc breakpoints and watchpoints, such as "A == 0x05 && [0x7E0010] > 3" or "value != 0".
+ * a condition is compiled once into a small bytecode, which is evaluated in C each time the breakpoint is hit,
+ * so that lua is only entered when the condition holds.
+ *
+ * the syntax is that of C integer expressions (with the same precedence), on 64-bit signed integers. Operands are:
+ *  - integer literals, in decimal, hex (0x7E or $7E) or binary (0b101).
+ *  - value: the value read or written (watchpoints), or the register's new value (register watches).
+ *  - address: the address executed or accessed, or the register's index (register watches).
+ *  - operation: as passed to watchpoint callbacks.
+ *  - the name of any of the cpu's registers (matched case-insensitively), which is read when the condition is checked.
+ *  - [address]: the byte at that address, peeked from the memory region.
+ * division by zero yields 0; && and || short-circuit.
+ */
+
+#include <hcdebug.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct retro_script_hc_condition retro_script_hc_condition_t;
+
+// registers are those of cpu, and [address] peeks from memory (either may be NULL, in which case they cannot be used).
+// returns NULL on failure, having written a message to error (which is error_size bytes).
+retro_script_hc_condition_t* retro_script_hc_condition_compile(const char* source, hc_Cpu const* cpu, hc_Memory const* memory, char* error, size_t error_size);
+
+// returns true if the condition holds for the given event.
+bool retro_script_hc_condition_eval(retro_script_hc_condition_t const*, hc_Event const*);
+
+void retro_script_hc_condition_free(retro_script_hc_condition_t*);
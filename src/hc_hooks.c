@@ -1,4 +1,5 @@
 #include "hc_hooks.h"
+#include "hc_condition.h"
 #include "core.h"
 #include "hashmap.h"
 #include "error.h"
@@ -9,20 +10,38 @@ typedef struct breakpoint_entry
 {
     retro_script_hc_breakpoint_userdata userdata;
     retro_script_breakpoint_cb cb;
+
+    // the callback is only invoked if this holds (if not NULL).
+    retro_script_hc_condition_t* condition;
 } breakpoint_entry;
 
 static struct retro_script_hashmap* breakpoint_hashmap = NULL;
 
+static void free_entry(size_t id, void* data)
+{
+    breakpoint_entry* entry = (breakpoint_entry*)data;
+    retro_script_hc_condition_free(entry->condition);
+    entry->condition = NULL;
+}
+
+static void destroy_breakpoint_hashmap()
+{
+    if (!breakpoint_hashmap) return;
+    retro_script_hashmap_foreach(breakpoint_hashmap, free_entry);
+    retro_script_hashmap_destroy(breakpoint_hashmap);
+    breakpoint_hashmap = NULL;
+}
+
 ON_INIT()
 {
-    if (breakpoint_hashmap) retro_script_hashmap_destroy(breakpoint_hashmap);
+    destroy_breakpoint_hashmap();
     breakpoint_hashmap = retro_script_hashmap_create(sizeof(breakpoint_entry));
 }
 
 // clear all scripts when a core is unloaded
 ON_DEINIT()
 {
-    if (breakpoint_hashmap) retro_script_hashmap_destroy(breakpoint_hashmap);
+    destroy_breakpoint_hashmap();
 }
 
 static void on_breakpoint(void* ud, hc_SubscriptionID id, hc_Event const* event)
@@ -34,7 +53,11 @@ static void on_breakpoint(void* ud, hc_SubscriptionID id, hc_Event const* event)
 
     if (entry)
     {
-        entry->cb(entry->userdata, id, event);
+        // (checked here, so that lua is not entered at all for hits which do not satisfy it.)
+        if (!entry->condition || retro_script_hc_condition_eval(entry->condition, event))
+        {
+            entry->cb(entry->userdata, id, event);
+        }
     }
 
     // otherwise, forward breakpoint callback to frontend
@@ -56,12 +79,33 @@ int retro_script_hc_register_breakpoint(retro_script_hc_breakpoint_userdata cons
     if (!entry) return 1;
     memcpy(&entry->userdata, userdata, sizeof(*userdata));
     entry->cb = cb;
+    entry->condition = NULL;
+    return 0;
+}
+
+int retro_script_hc_set_breakpoint_condition(hc_SubscriptionID breakpoint_id, retro_script_hc_condition_t* condition)
+{
+    breakpoint_entry* entry = breakpoint_hashmap
+        ? (breakpoint_entry*)retro_script_hashmap_get(breakpoint_hashmap, breakpoint_id)
+        : NULL;
+
+    if (!entry)
+    {
+        retro_script_hc_condition_free(condition);
+        return 1;
+    }
+    retro_script_hc_condition_free(entry->condition);
+    entry->condition = condition;
     return 0;
 }
 
 int retro_script_hc_unregister_breakpoint(hc_SubscriptionID breakpoint_id)
 {
     if (!retro_script_hc_get_debugger()) return 1;
+    breakpoint_entry* entry = (breakpoint_entry*)(
+        retro_script_hashmap_get(breakpoint_hashmap, breakpoint_id)
+    );
+    if (entry) free_entry(breakpoint_id, entry);
     return !retro_script_hashmap_remove(breakpoint_hashmap, breakpoint_id);
 }
 
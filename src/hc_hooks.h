@@ -5,6 +5,8 @@
 
 #include <hcdebug.h>
 
+struct retro_script_hc_condition;
+
 hc_DebuggerIf* retro_script_hc_get_debugger();
 // for efficiency reasons in use case, we provide three userdata slots.
 // (usage: <lua context, memory, lua callback ref>)
@@ -22,4 +24,7 @@ typedef struct retro_script_hc_breakpoint_userdata
 
 typedef void (*retro_script_breakpoint_cb)(retro_script_hc_breakpoint_userdata, hc_SubscriptionID breakpoint_id, hc_Event const*);
 int retro_script_hc_register_breakpoint(retro_script_hc_breakpoint_userdata const*, hc_SubscriptionID breakpoint_id, retro_script_breakpoint_cb); // returns 1 if failure
-int retro_script_hc_unregister_breakpoint(hc_SubscriptionID breakpoint_id); // returns 1 if failure
\ No newline at end of file
+int retro_script_hc_unregister_breakpoint(hc_SubscriptionID breakpoint_id); // returns 1 if failure
+
+// the breakpoint's callback will only be invoked when the condition holds. Takes ownership of the condition (which is freed even on failure).
+int retro_script_hc_set_breakpoint_condition(hc_SubscriptionID breakpoint_id, struct retro_script_hc_condition*); // returns 1 if failure
\ No newline at end of file
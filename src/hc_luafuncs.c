@@ -1,10 +1,15 @@
 #include "l.h"
 #include "hc_luafuncs.h"
 #include "hc_hooks.h"
-#include "hashmap.h"
+#include "hc_condition.h"
 #include "core.h"
 #include "hc_registers.h"
+#include "hc_trace.h"
+#include "memmap.h"
+#include "memjournal.h"
 #include "script.h"
+#include "script_list.h"
+#include "util.h"
 
 #include <libretro.h>
 #include <hcdebug.h>
@@ -23,45 +28,64 @@
 
 #define nargs(L) (lua_gettop(L))
 
-// caches tables representing hc objects like cpus and memory regions
-// TODO: this should be per-script.
-static struct retro_script_hashmap* lua_table_cache = NULL;
+// registry field of each script's table caching the tables which represent hc objects like cpus and memory regions,
+// keyed by the object's pointer (as light userdata). Its values are weak, so tables no longer referenced are collected.
+#define LUA_TABLE_CACHE "retro_script_hc_objects"
 
-ON_INIT()
+// hc memory regions found to coincide with the libretro memory map, so that ranges of bytes
+// can be accessed through host memory directly instead of peeking/poking one byte at a time.
+#define MAX_MEMORY_MAPPINGS 32
+typedef struct hc_memory_mapping
 {
-    if (lua_table_cache) retro_script_hashmap_destroy(lua_table_cache);
-    lua_table_cache = retro_script_hashmap_create(sizeof(lua_Integer));
-}
+    hc_Memory const* mem;
+    
+    // memory map generation this was determined for.
+    uint32_t generation;
+    
+    bool mapped;
+    const char* addrspace;
+} hc_memory_mapping_t;
+
+static hc_memory_mapping_t memory_mappings[MAX_MEMORY_MAPPINGS];
+static size_t num_memory_mappings = 0;
+
+static void free_deferred_subscriptions();
 
 ON_DEINIT()
 {
-    if (lua_table_cache) retro_script_hashmap_destroy(lua_table_cache);
+    num_memory_mappings = 0;
+    free_deferred_subscriptions();
 }
 
-// retrieves a unique persistent lua table for the given pointer
+// retrieves a unique lua table for the given pointer, which persists while the script references it.
 // returns 0 if table already existed.
 static bool lua_table_for_data(lua_State* L, void const* ptr)
 {
-    uintptr_t v = (uintptr_t)ptr;
-    lua_Integer* refptr = retro_script_hashmap_get(lua_table_cache, v);
-    if (refptr == NULL)
+    if (!luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_TABLE_CACHE))
     {
-        // add a hashmap entry
-        refptr = retro_script_hashmap_add(lua_table_cache, v);
-        
-        // create lua table. Duplicate it so a copy stays on the stack afterward.
-        lua_newtable(L);
-        lua_pushvalue(L, -1);
-        
-        // set the hashmap entry to a ref for this table.
-        *refptr = luaL_ref(L, LUA_REGISTRYINDEX);
-        return 1;
+        lua_createtable(L, 0, 1);
+        lua_pushstring(L, "v");
+        lua_rawsetfield(L, -2, "__mode");
+        lua_setmetatable(L, -2);
     }
-    else
+    
+    lua_pushlightuserdata(L, (void*)ptr);
+    const bool exists = lua_rawget(L, -2) != LUA_TNIL;
+    if (!exists)
     {
-        lua_rawgeti(L, LUA_REGISTRYINDEX, *refptr);
-        return 0;
+        lua_pop(L, 1);
+        
+        // create lua table, and add it to the cache. A copy stays on the stack afterward.
+        lua_newtable(L);
+        lua_pushlightuserdata(L, (void*)ptr);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, -4);
     }
+    
+    // remove the cache from beneath the table.
+    lua_rotate(L, -2, 1);
+    lua_pop(L, 1);
+    return !exists;
 }
 
 static void assert_argc_range(lua_State* L, int lower, int upper)
@@ -86,6 +110,11 @@ static void assert_argc(lua_State* L, int count)
 // luaL_error is called on failure.
 static void* get_userdata_from_self(lua_State* L)
 {
+    // methods materialised by __index are closures with their object's userdata as the first upvalue,
+    // which is much cheaper to fetch than the field of self.
+    void* bound = lua_touserdata(L, lua_upvalueindex(1));
+    if (bound) return bound;
+    
     if (lua_gettop(L) <= 0) goto FAIL;
     if (!lua_istable(L, 1)) goto FAIL;
     
@@ -106,28 +135,102 @@ FAIL:
     return NULL;
 }
 
-static inline void poke_range(hc_Memory const* mem, uint64_t start, size_t count, const void* vdata, bool reverse)
+// a region is accessed through the memory map only if the core provided the map, and the region's id names one of
+// its addrspaces. (regions cannot be matched to memory by content: sampling them would peek at i/o, and memory
+// which happens to hold the same values, e.g. zeroes at load, would be mistaken for them.)
+static bool determine_mapping(hc_Memory const* mem, hc_memory_mapping_t* mapping)
+{
+    mapping->mapped = false;
+    mapping->addrspace = NULL;
+    if (!retro_script_memory_map_from_core || !mem->v1.id) return false;
+    
+    for (char const* const* addrspace = retro_script_list_memory_addrspaces(); addrspace && *addrspace; ++addrspace)
+    {
+        if (**addrspace && !strcmp(*addrspace, mem->v1.id)) mapping->addrspace = *addrspace;
+    }
+    
+    mapping->mapped = mapping->addrspace != NULL;
+    return mapping->mapped;
+}
+
+// returns the addrspace through which the region can be accessed directly, or NULL if it cannot.
+static const char* get_mapping(hc_Memory const* mem)
 {
-    const char* data = (const char*)vdata;
+    const uint32_t generation = retro_script_memory_map_generation();
+    hc_memory_mapping_t* mapping = NULL;
+    for (size_t i = 0; i < num_memory_mappings && !mapping; ++i)
+    {
+        if (memory_mappings[i].mem == mem) mapping = &memory_mappings[i];
+    }
+    
+    if (!mapping)
+    {
+        if (num_memory_mappings >= MAX_MEMORY_MAPPINGS) return NULL;
+        mapping = &memory_mappings[num_memory_mappings++];
+        mapping->mem = mem;
+        mapping->generation = generation;
+        determine_mapping(mem, mapping);
+    }
+    else if (mapping->generation != generation)
+    {
+        mapping->generation = generation;
+        determine_mapping(mem, mapping);
+    }
+    
+    return mapping->mapped ? mapping->addrspace : NULL;
+}
+
+// these access the memory map directly where the region coincides with it, falling back to peek/poke.
+static void read_range(hc_Memory const* mem, uint64_t start, size_t count, void* vdata)
+{
+    const char* addrspace = get_mapping(mem);
+    if (addrspace && start + count >= start && retro_script_memory_read_bytes_in(addrspace, start, vdata, count)) return;
+    
+    uint8_t* data = (uint8_t*)vdata;
     for (size_t i = 0; i < count; ++i)
     {
-        size_t index = reverse ? (count - i - 1) : i;
-        mem->v1.poke(start + index, *data);
-        data++;
+        data[i] = mem->v1.peek(start + i);
     }
 }
 
-static inline void peek_range(hc_Memory const* mem, uint64_t start, size_t count, void* vdata, bool reverse)
+static void write_range(hc_Memory const* mem, uint64_t start, size_t count, const void* vdata)
 {
-    char* data = (char*)vdata;
+    const char* addrspace = get_mapping(mem);
+    if (addrspace && start + count >= start && retro_script_journal_write_now_in(addrspace, start, vdata, count)) return;
+    
+    const uint8_t* data = (const uint8_t*)vdata;
     for (size_t i = 0; i < count; ++i)
     {
-        size_t index = reverse ? (count - i - 1) : i;
-        *data = mem->v1.peek(start + index);
-        data++;
+        mem->v1.poke(start + i, data[i]);
     }
 }
 
+static void reverse_bytes(void* vdata, size_t count)
+{
+    uint8_t* data = (uint8_t*)vdata;
+    for (size_t i = 0; i < count / 2; ++i)
+    {
+        const uint8_t tmp = data[i];
+        data[i] = data[count - i - 1];
+        data[count - i - 1] = tmp;
+    }
+}
+
+// (count is at most 8.)
+static inline void poke_range(hc_Memory const* mem, uint64_t start, size_t count, const void* vdata, bool reverse)
+{
+    uint8_t data[8];
+    memcpy(data, vdata, count);
+    if (reverse) reverse_bytes(data, count);
+    write_range(mem, start, count, data);
+}
+
+static inline void peek_range(hc_Memory const* mem, uint64_t start, size_t count, void* vdata, bool reverse)
+{
+    read_range(mem, start, count, vdata);
+    if (reverse) reverse_bytes(vdata, count);
+}
+
 // endianness
 static const int be = 0;
 static const int le = 1;
@@ -225,20 +328,29 @@ static hc_SubscriptionID breakpoint_register(lua_State* L, hc_Subscription const
     return id;
 }
 
+// pops the arguments, and pushes retc results.
 static void pcall_function_from_ref(lua_State* L, lua_Integer ref, const int argc, const int retc)
 {
-    const int top = lua_gettop(L);
+    const int base = lua_gettop(L) - argc;
     lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
     if (lua_isfunction(L, -1))
     {
         int result = retro_script_lua_pcall(L, argc, retc);
         retro_script_on_uncaught_error(L, result);
         if (result != LUA_OK) goto return_nils;
+        
+        // the message handler remains below the results; this is called for every hit, so the stack must not grow.
+        const int extra = lua_gettop(L) - base - retc;
+        if (extra > 0)
+        {
+            lua_rotate(L, base + 1, -extra);
+            lua_pop(L, extra);
+        }
     }
     else
     {
     return_nils:
-        lua_settop(L, top);
+        lua_settop(L, base);
         for (int i = 0; i < retc; ++i)
         {
             lua_pushnil(L);
@@ -246,6 +358,283 @@ static void pcall_function_from_ref(lua_State* L, lua_Integer ref, const int arg
     }
 }
 
+// a subscription whose events are queued while the core runs, and passed to lua together once the frame has run
+// (see retro.hc.defer_events), so that emulation is not interrupted to call into lua.
+typedef struct deferred_subscription
+{
+    lua_State* L;
+    lua_Integer ref;
+    hc_SubscriptionID id;
+    bool removed;
+    
+    // cpu (and index of its PC register) whose PC is recorded with each event, if known.
+    hc_Cpu const* cpu;
+    int pc_register;
+    
+    // ring buffer of capacity events, each DEFERRED_EVENT_FIELDS values: address, operation, value, pc.
+    uint64_t* events;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    
+    // number of events overwritten since the last delivery.
+    size_t dropped;
+    
+    struct deferred_subscription* next;
+} deferred_subscription_t;
+
+#define DEFERRED_EVENT_FIELDS 4
+#define DEFERRED_EVENT_CAPACITY 4096
+
+static deferred_subscription_t* deferred_subscriptions = NULL;
+
+static void on_deferred_event(retro_script_hc_breakpoint_userdata u, hc_SubscriptionID id, hc_Event const* e)
+{
+    deferred_subscription_t* sub = (deferred_subscription_t*)u.values[0].ptr;
+    if (sub->removed) return;
+    
+    uint64_t address = 0, operation = 0, value = 0;
+    switch (e->type)
+    {
+    case HC_EVENT_EXECUTION:
+        address = e->execution.address;
+        break;
+    case HC_EVENT_MEMORY:
+        address = e->memory.address;
+        operation = e->memory.operation;
+        value = e->memory.value;
+        break;
+    case HC_EVENT_REG:
+        address = e->reg.reg;
+        value = e->reg.new_value;
+        break;
+    default:
+        break;
+    }
+    
+    uint64_t pc = (uint64_t)-1;
+    if (e->type == HC_EVENT_EXECUTION)
+    {
+        pc = address;
+    }
+    else if (sub->cpu && sub->pc_register >= 0 && sub->cpu->v1.get_register)
+    {
+        pc = sub->cpu->v1.get_register(sub->pc_register);
+    }
+    
+    // when full, the oldest event is overwritten.
+    size_t tail = (sub->head + sub->count) % sub->capacity;
+    if (sub->count == sub->capacity)
+    {
+        sub->head = (sub->head + 1) % sub->capacity;
+        ++sub->dropped;
+    }
+    else
+    {
+        ++sub->count;
+    }
+    
+    uint64_t* event = &sub->events[DEFERRED_EVENT_FIELDS * tail];
+    event[0] = address;
+    event[1] = operation;
+    event[2] = value;
+    event[3] = pc;
+}
+
+static int get_pc_register(hc_Cpu const* cpu)
+{
+    if (!cpu) return -1;
+    const int num_registers = retro_script_hc_get_cpu_register_count(cpu->v1.type);
+    for (int i = 0; i < num_registers; ++i)
+    {
+        const char* name = retro_script_hc_get_cpu_register_name(cpu->v1.type, i);
+        if (name && !strcmp(name, "PC")) return i;
+    }
+    return -1;
+}
+
+static void free_deferred_subscription(deferred_subscription_t* sub)
+{
+    if (sub->L) luaL_unref(sub->L, LUA_REGISTRYINDEX, sub->ref);
+    if (sub->events) free(sub->events);
+    free(sub);
+}
+
+// marks the deferred subscription with the given id (if any) as removed; it is freed after the next delivery.
+static void remove_deferred_subscription(hc_SubscriptionID id)
+{
+    for (deferred_subscription_t* sub = deferred_subscriptions; sub; sub = sub->next)
+    {
+        if (sub->id == id) sub->removed = true;
+    }
+}
+
+// frees the subscriptions marked as removed (and, if L is not NULL, those of that lua state).
+static void sweep_deferred_subscriptions(lua_State* L)
+{
+    deferred_subscription_t** sub = &deferred_subscriptions;
+    while (*sub)
+    {
+        if ((*sub)->removed || (L && (*sub)->L == L))
+        {
+            deferred_subscription_t* next = (*sub)->next;
+            if (!(*sub)->removed)
+            {
+                retro_script_hc_unregister_breakpoint((*sub)->id);
+                if (debugger && debugger->v1.unsubscribe) debugger->v1.unsubscribe((*sub)->id);
+            }
+            free_deferred_subscription(*sub);
+            *sub = next;
+        }
+        else
+        {
+            sub = &(*sub)->next;
+        }
+    }
+}
+
+// (the core's subscriptions end with it. The scripts' lua states may already be closed, so their refs are left.)
+static void free_deferred_subscriptions()
+{
+    while (deferred_subscriptions)
+    {
+        deferred_subscription_t* next = deferred_subscriptions->next;
+        deferred_subscriptions->L = NULL;
+        free_deferred_subscription(deferred_subscriptions);
+        deferred_subscriptions = next;
+    }
+}
+
+void retro_script_hc_deliver_events()
+{
+    for (deferred_subscription_t* sub = deferred_subscriptions; sub; sub = sub->next)
+    {
+        if (sub->removed || sub->count == 0) continue;
+        lua_State* L = sub->L;
+        const int top = lua_gettop(L);
+        
+        // copy the events out first, as the callback may cause more.
+        lua_createtable(L, DEFERRED_EVENT_FIELDS * sub->count, 0);
+        for (size_t i = 0; i < sub->count; ++i)
+        {
+            uint64_t const* event = &sub->events[DEFERRED_EVENT_FIELDS * ((sub->head + i) % sub->capacity)];
+            for (size_t j = 0; j < DEFERRED_EVENT_FIELDS; ++j)
+            {
+                lua_pushinteger(L, (lua_Integer)event[j]);
+                lua_rawseti(L, -2, DEFERRED_EVENT_FIELDS * i + j + 1);
+            }
+        }
+        lua_pushinteger(L, sub->dropped);
+        sub->head = 0;
+        sub->count = 0;
+        sub->dropped = 0;
+        
+        pcall_function_from_ref(L, sub->ref, 2, 0);
+        lua_settop(L, top);
+    }
+    
+    sweep_deferred_subscriptions(NULL);
+}
+
+void retro_script_hc_free_events(struct script_state* script)
+{
+    if (!script) return;
+    sweep_deferred_subscriptions(script->L);
+}
+
+// subscribes with the callback on top of the stack, queueing its events.
+// pushes the breakpoint id, and returns it (or -1 if unsuccessful).
+static hc_SubscriptionID breakpoint_register_deferred(lua_State* L, script_state_t* script, hc_Subscription const* s, hc_Cpu const* cpu)
+{
+    deferred_subscription_t* sub = alloc(deferred_subscription_t);
+    if (!sub) return -1;
+    memset(sub, 0, sizeof(*sub));
+    sub->capacity = script->hc_event_capacity ? script->hc_event_capacity : DEFERRED_EVENT_CAPACITY;
+    sub->events = malloc_array(uint64_t, DEFERRED_EVENT_FIELDS * sub->capacity);
+    if (!sub->events)
+    {
+        free_deferred_subscription(sub);
+        return -1;
+    }
+    
+    sub->id = debugger->v1.subscribe(s);
+    if (sub->id < 0)
+    {
+        free_deferred_subscription(sub);
+        return -1;
+    }
+    
+    lua_pushvalue(L, -1);
+    sub->L = L;
+    sub->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    sub->cpu = cpu;
+    sub->pc_register = get_pc_register(cpu);
+    sub->next = deferred_subscriptions;
+    deferred_subscriptions = sub;
+    
+    retro_script_hc_breakpoint_userdata u;
+    u.values[0].ptr = sub;
+    u.values[1].u64 = 0;
+    retro_script_hc_register_breakpoint(&u, sub->id, on_deferred_event);
+    
+    lua_pushinteger(L, sub->id);
+    return sub->id;
+}
+
+// subscribes with the callback on top of the stack, queueing its events if the script defers them.
+// cpu is that whose PC is recorded with deferred events (may be NULL).
+// the callback is only invoked (or the event queued) if the condition holds (if not NULL); takes ownership of it.
+// pushes the breakpoint id, and returns it (or -1 if unsuccessful).
+static hc_SubscriptionID breakpoint_register_deferrable(lua_State* L, hc_Subscription const* s, retro_script_breakpoint_cb cb, hc_Cpu const* cpu, retro_script_hc_condition_t* condition)
+{
+    script_state_t* script = script_find_lua(L);
+    const hc_SubscriptionID id = (script && script->defer_hc_events)
+        ? breakpoint_register_deferred(L, script, s, cpu)
+        : breakpoint_register(L, s, cb);
+    
+    if (id < 0)
+    {
+        retro_script_hc_condition_free(condition);
+    }
+    else if (condition)
+    {
+        retro_script_hc_set_breakpoint_condition(id, condition);
+    }
+    return id;
+}
+
+// compiles the condition string at idx, if any (there is none if idx is 0 or the argument is nil).
+// luaL_error is called if it is invalid.
+static retro_script_hc_condition_t* get_condition(lua_State* L, int idx, hc_Cpu const* cpu, hc_Memory const* memory, const char* func)
+{
+    if (idx <= 0 || lua_isnil(L, idx)) return NULL;
+    if (!lua_isstring(L, idx))
+    {
+        luaL_error(L, "invalid condition for \"%s\"", func);
+        return NULL;
+    }
+    
+    char error[128];
+    retro_script_hc_condition_t* condition = retro_script_hc_condition_compile(lua_tostring(L, idx), cpu, memory, error, sizeof(error));
+    if (!condition) luaL_error(L, "invalid condition for \"%s\": %s", func, error);
+    return condition;
+}
+
+// lua args: [enable], [capacity]
+int retro_script_luafunc_hc_defer_events(lua_State* L)
+{
+    script_state_t* script = script_find_lua(L);
+    if (!script) return luaL_error(L, "invalid lua context");
+    
+    script->defer_hc_events = nargs(L) < 1 || lua_isnil(L, 1) || lua_toboolean(L, 1);
+    if (nargs(L) >= 2 && !lua_isnil(L, 2))
+    {
+        if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) <= 0) return luaL_error(L, "invalid capacity for \"defer_events\"");
+        script->hc_event_capacity = lua_tointeger(L, 2);
+    }
+    return 0;
+}
+
 static void on_step_event(retro_script_hc_breakpoint_userdata u, hc_SubscriptionID id, hc_Event const* e)
 {
     // step events only fire once. Unregister this event.
@@ -337,6 +726,44 @@ static int memory_poke(lua_State* L)
     return 0;
 }
 
+static int memory_read_bytes(lua_State* L)
+{
+    assert_argc(L, 3);
+    
+    hc_Memory const* memory = (hc_Memory const*)get_userdata_from_self(L);
+    if (!memory || !memory->v1.peek) return 0;
+    
+    uint64_t address = lua_tointeger(L, 2);
+    lua_Integer length = lua_tointeger(L, 3);
+    if (length < 0) return luaL_error(L, "invalid length for \"read_bytes\"");
+    
+    char buff[256];
+    char* data = ((size_t)length <= sizeof(buff)) ? buff : malloc_array(char, length);
+    if (!data) return luaL_error(L, "unable to allocate memory for \"read_bytes\"");
+    
+    read_range(memory, address, length, data);
+    lua_pushlstring(L, data, length);
+    
+    if (data != buff) free(data);
+    return 1;
+}
+
+static int memory_write_bytes(lua_State* L)
+{
+    assert_argc(L, 3);
+    
+    hc_Memory const* memory = (hc_Memory const*)get_userdata_from_self(L);
+    if (!memory || !memory->v1.poke) return 0;
+    
+    uint64_t address = lua_tointeger(L, 2);
+    if (!lua_isstring(L, 3)) return luaL_error(L, "invalid data for \"write_bytes\"");
+    size_t length;
+    const char* data = lua_tolstring(L, 3, &length);
+    
+    write_range(memory, address, length, data);
+    return 0;
+}
+
 static int memory_memset(lua_State* L)
 {
     assert_argc(L, 4);
@@ -348,9 +775,11 @@ static int memory_memset(lua_State* L)
     uint8_t value = lua_tointeger(L, 3);
     uint64_t length = lua_tointeger(L, 4);
     
-    for (size_t i = 0; i < length; ++i)
+    uint8_t buff[256];
+    memset(buff, value, sizeof(buff));
+    for (uint64_t i = 0; i < length; i += sizeof(buff))
     {
-        memory->v1.poke(address + i, value);
+        write_range(memory, address + i, (length - i < sizeof(buff)) ? length - i : sizeof(buff), buff);
     }
     
     return 0;
@@ -367,7 +796,15 @@ static int memory_memcpy(lua_State* L)
     uint64_t src = lua_tointeger(L, 3);
     uint64_t length = lua_tointeger(L, 4);
     
-    if (dst < src)
+    // copy through a buffer, which behaves as memmove.
+    uint8_t* data = (length > 0 && length <= SIZE_MAX) ? malloc_array(uint8_t, length) : NULL;
+    if (data)
+    {
+        read_range(memory, src, length, data);
+        write_range(memory, dst, length, data);
+        free(data);
+    }
+    else if (dst < src)
     {
         for (size_t i = 0; i < length; ++i)
         {
@@ -384,6 +821,7 @@ static int memory_memcpy(lua_State* L)
     
     return 0;
 }
+
 static int memory_memswap(lua_State* L)
 {
     assert_argc(L, 4);
@@ -395,7 +833,18 @@ static int memory_memswap(lua_State* L)
     uint64_t src = lua_tointeger(L, 3);
     uint64_t length = lua_tointeger(L, 4);
     
-    if (dst < src)
+    // ranges which do not overlap are swapped through buffers.
+    const bool overlap = (dst < src) ? src - dst < length : dst - src < length;
+    uint8_t* data = (!overlap && length > 0 && length <= SIZE_MAX / 2) ? malloc_array(uint8_t, 2 * length) : NULL;
+    if (data)
+    {
+        read_range(memory, dst, length, data);
+        read_range(memory, src, length, data + length);
+        write_range(memory, dst, length, data + length);
+        write_range(memory, src, length, data);
+        free(data);
+    }
+    else if (dst < src)
     {
         for (size_t i = 0; i < length; ++i)
         {
@@ -470,6 +919,21 @@ static void on_register_breakpoint(retro_script_hc_breakpoint_userdata u, hc_Sub
     pcall_function_from_ref(L, ref, argc, 0);
 }
 
+// retrieves the index of the register, from the second upvalue if bound (as for userdata), else from self.
+static bool get_register_index(lua_State* L, lua_Integer* idx)
+{
+    if (lua_isinteger(L, lua_upvalueindex(2)))
+    {
+        *idx = lua_tointeger(L, lua_upvalueindex(2));
+        return true;
+    }
+    
+    const bool found = lua_rawgetfield(L, 1, "_idx") == LUA_TNUMBER;
+    if (found) *idx = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    return found;
+}
+
 // lua args: self
 //      ret: value
 static int get_register(lua_State* L)
@@ -480,15 +944,7 @@ static int get_register(lua_State* L)
     if (!cpu) return 0;
     
     lua_Integer idx;
-    if (lua_rawgetfield(L, 1, "_idx") == LUA_TNUMBER)
-    {
-        idx = lua_tointeger(L, -1);
-    }
-    else
-    {
-        lua_pop(L, 1);
-        return 0;
-    }
+    if (!get_register_index(L, &idx)) return 0;
     
     if (!cpu->v1.get_register) return 0;
     
@@ -507,16 +963,7 @@ static int set_register(lua_State* L)
     if (!cpu) return 0;
     
     lua_Integer idx;
-    if (lua_rawgetfield(L, 1, "_idx") == LUA_TNUMBER)
-    {
-        idx = lua_tointeger(L, -1);
-        lua_pop(L, 1);
-    }
-    else
-    {
-        lua_pop(L, 1);
-        return 0;
-    }
+    if (!get_register_index(L, &idx)) return 0;
     
     if (!cpu->v1.set_register) return 0;
     
@@ -528,27 +975,209 @@ static int set_register(lua_State* L)
     return 0;
 }
 
-// lua args: self, callback
-static int set_register_breakpoint(lua_State* L)
+// lua args: self, [table]
+//      ret: table mapping each register's name (or index, if it has no name) to its value
+static int cpu_get_registers(lua_State* L)
 {
-    assert_argc(L, 2);
-    if (!lua_isfunction(L, 2)) return 0;
+    assert_argc_range(L, 1, 2);
     
     hc_Cpu const* cpu = (hc_Cpu const*)get_userdata_from_self(L);
-    if (!cpu) return 0;
+    if (!cpu || !cpu->v1.get_register) return 0;
     
-    lua_Integer idx;
-    if (lua_rawgetfield(L, 0, "_idx") == LUA_TNUMBER)
+    const int num_registers = retro_script_hc_get_cpu_register_count(cpu->v1.type);
+    if (num_registers < 0) return 0;
+    
+    // fill the given table if any, so that it can be reused between calls.
+    if (nargs(L) >= 2 && lua_istable(L, 2))
     {
-        idx = lua_tointeger(L, -1);
-        lua_pop(L, 1);
+        lua_settop(L, 2);
     }
     else
     {
+        lua_settop(L, 1);
+        lua_createtable(L, 0, num_registers);
+    }
+    
+    for (int i = 0; i < num_registers; ++i)
+    {
+        const char* name = retro_script_hc_get_cpu_register_name(cpu->v1.type, i);
+        lua_pushinteger(L, cpu->v1.get_register(i));
+        if (name && *name)
+        {
+            lua_rawsetfield(L, -2, name);
+        }
+        else
+        {
+            lua_rawseti(L, -2, i + 1);
+        }
+    }
+    
+    return 1;
+}
+
+// lua args: self, table (as returned by get_registers; registers which are absent are left unchanged)
+//      ret: number of registers set
+static int cpu_set_registers(lua_State* L)
+{
+    assert_argc(L, 2);
+    if (!lua_istable(L, 2)) return luaL_error(L, "invalid registers for \"set_registers\"");
+    
+    hc_Cpu const* cpu = (hc_Cpu const*)get_userdata_from_self(L);
+    if (!cpu || !cpu->v1.set_register) return 0;
+    
+    const int num_registers = retro_script_hc_get_cpu_register_count(cpu->v1.type);
+    lua_Integer count = 0;
+    for (int i = 0; i < num_registers; ++i)
+    {
+        const char* name = retro_script_hc_get_cpu_register_name(cpu->v1.type, i);
+        if (name && *name)
+        {
+            lua_rawgetfield(L, 2, name);
+        }
+        else
+        {
+            lua_rawgeti(L, 2, i + 1);
+        }
+        
+        if (lua_isinteger(L, -1) && cpu->v1.set_register(i, lua_tointeger(L, -1)))
+        {
+            ++count;
+        }
         lua_pop(L, 1);
-        return 0;
     }
     
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+// most registers which can be recorded with each instruction of a trace.
+#define MAX_TRACE_REGISTERS 64
+
+// lua args: self, capacity, [registers: true for all, or a list of register names or indices]
+//      ret: 1 if the trace was started, 0 otherwise
+static int cpu_start_trace(lua_State* L)
+{
+    assert_argc_range(L, 2, 3);
+    if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) <= 0) return luaL_error(L, "invalid capacity for \"start_trace\"");
+    
+    hc_Cpu const* cpu = (hc_Cpu const*)get_userdata_from_self(L);
+    if (!cpu) return 0;
+    
+    script_state_t* script = script_find_lua(L);
+    if (!script) return luaL_error(L, "invalid lua context");
+    
+    const int num_cpu_registers = retro_script_hc_get_cpu_register_count(cpu->v1.type);
+    unsigned registers[MAX_TRACE_REGISTERS];
+    size_t num_registers = 0;
+    if (nargs(L) >= 3 && lua_isboolean(L, 3) && lua_toboolean(L, 3))
+    {
+        while (num_registers < MAX_TRACE_REGISTERS && (int)num_registers < num_cpu_registers)
+        {
+            registers[num_registers] = num_registers;
+            ++num_registers;
+        }
+    }
+    else if (nargs(L) >= 3 && lua_istable(L, 3))
+    {
+        const size_t len = lua_rawlen(L, 3);
+        if (len > MAX_TRACE_REGISTERS) return luaL_error(L, "too many registers for \"start_trace\"");
+        for (size_t i = 1; i <= len; ++i)
+        {
+            // (by name, or by index as in cpu.registers.)
+            int reg = -1;
+            lua_rawgeti(L, 3, i);
+            if (lua_isinteger(L, -1))
+            {
+                const lua_Integer idx = lua_tointeger(L, -1);
+                if (idx >= 1 && (num_cpu_registers < 0 ? idx <= MAX_TRACE_REGISTERS : idx <= num_cpu_registers)) reg = idx - 1;
+            }
+            else if (lua_isstring(L, -1))
+            {
+                const char* name = lua_tostring(L, -1);
+                for (int j = 0; j < num_cpu_registers && reg < 0; ++j)
+                {
+                    const char* register_name = retro_script_hc_get_cpu_register_name(cpu->v1.type, j);
+                    if (register_name && !strcmp(register_name, name)) reg = j;
+                }
+            }
+            lua_pop(L, 1);
+            
+            if (reg < 0) return luaL_error(L, "invalid register for \"start_trace\"");
+            registers[num_registers++] = reg;
+        }
+    }
+    else if (nargs(L) >= 3 && !lua_isnil(L, 3) && !lua_isboolean(L, 3))
+    {
+        return luaL_error(L, "invalid registers for \"start_trace\"");
+    }
+    
+    const bool started = retro_script_hc_trace_start(script->id, cpu, lua_tointeger(L, 2), registers, num_registers);
+    lua_pushinteger(L, started ? 1 : 0);
+    return 1;
+}
+
+// lua args: self
+//      ret: 1 if a trace was stopped, 0 otherwise
+static int cpu_stop_trace(lua_State* L)
+{
+    assert_argc(L, 1);
+    
+    hc_Cpu const* cpu = (hc_Cpu const*)get_userdata_from_self(L);
+    script_state_t* script = script_find_lua(L);
+    if (!cpu || !script) return 0;
+    
+    lua_pushinteger(L, retro_script_hc_trace_stop(script->id, cpu) ? 1 : 0);
+    return 1;
+}
+
+// whether the records of a trace should be discarded once read (which they are by default).
+static bool get_trace_clear(lua_State* L, int idx)
+{
+    return nargs(L) < idx || lua_isnil(L, idx) || lua_toboolean(L, idx);
+}
+
+// lua args: self, [clear=true]
+//      ret: records (as a string), number of records, number of records overwritten; or nil if there is no trace
+static int cpu_read_trace(lua_State* L)
+{
+    assert_argc_range(L, 1, 2);
+    
+    hc_Cpu const* cpu = (hc_Cpu const*)get_userdata_from_self(L);
+    script_state_t* script = script_find_lua(L);
+    if (!cpu || !script) return 0;
+    
+    return retro_script_hc_trace_push(L, script->id, cpu, get_trace_clear(L, 2));
+}
+
+// lua args: self, path, [clear=true]
+//      ret: number of records written, or nil if there is no trace or the file could not be written
+static int cpu_dump_trace(lua_State* L)
+{
+    assert_argc_range(L, 2, 3);
+    if (!lua_isstring(L, 2)) return luaL_error(L, "invalid path for \"dump_trace\"");
+    
+    hc_Cpu const* cpu = (hc_Cpu const*)get_userdata_from_self(L);
+    script_state_t* script = script_find_lua(L);
+    if (!cpu || !script) return 0;
+    
+    const int64_t count = retro_script_hc_trace_dump(script->id, cpu, lua_tostring(L, 2), get_trace_clear(L, 3));
+    if (count < 0) return 0;
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+// lua args: self, [condition], callback
+static int set_register_breakpoint(lua_State* L)
+{
+    assert_argc_range(L, 2, 3);
+    if (!lua_isfunction(L, -1)) return 0;
+    
+    hc_Cpu const* cpu = (hc_Cpu const*)get_userdata_from_self(L);
+    if (!cpu) return 0;
+    
+    lua_Integer idx;
+    if (!get_register_index(L, &idx)) return 0;
+    
     hc_Subscription s;
     {
         s.type = HC_EVENT_REG;
@@ -556,14 +1185,23 @@ static int set_register_breakpoint(lua_State* L)
         s.reg.reg = idx;
     }
     
-    return breakpoint_register(L, &s, on_register_breakpoint) >= 0;
+    retro_script_hc_condition_t* condition = get_condition(L, nargs(L) == 3 ? 2 : 0, cpu, cpu->v1.memory_region, "watch");
+    return breakpoint_register_deferrable(L, &s, on_register_breakpoint, cpu, condition) >= 0;
 }
 
-// lua args: self, address, length, [read/write string], callback
+// a watchpoint's mode consists of 'r' and/or 'w'.
+static bool is_watch_mode(lua_State* L, int idx)
+{
+    if (!lua_isstring(L, idx)) return false;
+    const char* mode = lua_tostring(L, idx);
+    return *mode && strspn(mode, "rw") == strlen(mode);
+}
+
+// lua args: self, address, length, [read/write string], [condition], callback
 //      ret: breakpoint id
 static int memory_set_watchpoint(lua_State* L)
 {
-    assert_argc_range(L, 4, 5);
+    assert_argc_range(L, 4, 6);
     if (!lua_isfunction(L, -1)) return 0;
     
     hc_Memory const* memory = (hc_Memory const*)get_userdata_from_self(L);
@@ -571,7 +1209,10 @@ static int memory_set_watchpoint(lua_State* L)
     
     uint64_t address = lua_tointeger(L, 2);
     uint64_t length = lua_tointeger(L, 3);
-    const char* mode = lua_isstring(L, 4) ? lua_tostring(L, 4) : NULL;
+    
+    // with only one of the optional arguments, it is the mode if it looks like one, and otherwise the condition.
+    const int condition_idx = (nargs(L) == 6 || (nargs(L) == 5 && !is_watch_mode(L, 4))) ? nargs(L) - 1 : 0;
+    const char* mode = (condition_idx != 4 && lua_isstring(L, 4)) ? lua_tostring(L, 4) : NULL;
     const bool watch_read = mode ? !!strchr(mode, 'r') : 0;
     const bool watch_write = mode ? !!strchr(mode, 'w') : 1;
     
@@ -586,7 +1227,15 @@ static int memory_set_watchpoint(lua_State* L)
         if (watch_write) s.memory.operation |= HC_MEMORY_WRITE;
     }
     
-    return breakpoint_register(L, &s, on_memory_access) >= 0;
+    // (events are attributed to the cpu addressing this memory, if any.)
+    hc_Cpu const* cpu = NULL;
+    for (size_t i = 0; system && i < system->v1.num_cpus && !cpu; ++i)
+    {
+        if (system->v1.cpus[i] && system->v1.cpus[i]->v1.memory_region == memory) cpu = system->v1.cpus[i];
+    }
+    
+    retro_script_hc_condition_t* condition = get_condition(L, condition_idx, cpu, memory, "set_watchpoint");
+    return breakpoint_register_deferrable(L, &s, on_memory_access, cpu, condition) >= 0;
 }
 
 // args: self, callback
@@ -607,11 +1256,11 @@ static int breakpoint_enable(lua_State* L)
     return breakpoint_register(L, &s, on_breakpoint) >= 0;
 }
 
-// args: self, address, callback
+// args: self, address, [condition], callback
 //  ret: breakpoint id
 static int cpu_set_exec_breakpoint(lua_State* L)
 {
-    assert_argc(L, 3);
+    assert_argc_range(L, 3, 4);
     
     hc_Cpu const* cpu = (hc_Cpu const*)get_userdata_from_self(L);
     if (!cpu || !debugger->v1.subscribe) return 0;
@@ -627,7 +1276,8 @@ static int cpu_set_exec_breakpoint(lua_State* L)
         s.execution.address_range_end = address + 1;
     }
     
-    return breakpoint_register(L, &s, on_cpu_exec) >= 0;
+    retro_script_hc_condition_t* condition = get_condition(L, nargs(L) == 4 ? 3 : 0, cpu, cpu->v1.memory_region, "set_exec_breakpoint");
+    return breakpoint_register_deferrable(L, &s, on_cpu_exec, cpu, condition) >= 0;
 }
 
 static int push_breakpoint(lua_State* L, hc_GenericBreakpoint const* breakpoint)
@@ -650,98 +1300,275 @@ static int push_breakpoint(lua_State* L, hc_GenericBreakpoint const* breakpoint)
     return 1;
 }
 
-static int push_memory_region(lua_State* L, hc_Memory const* mem)
+// hc objects are tables holding just their userdata, sharing a metatable whose __index materialises
+// other fields on first access (storing them in the object, so later accesses do not reach __index).
+// so creating an object costs the same however many registers or accessors it has.
+// methods are bound to their object's userdata (and register index) as upvalues.
+
+#define NEEDS_PEEK 1
+#define NEEDS_POKE 2
+#define NEEDS_GET_REGISTER 4
+#define NEEDS_SET_REGISTER 8
+
+typedef struct hc_method
 {
-    if (lua_table_for_data(L, mem))
+    const char* name;
+    lua_CFunction func;
+    unsigned needs;
+} hc_method_t;
+
+#define MEMORY_ACCESS_METHODS(name, type) \
+    { "read_" #name "_le", hc_memory_read_##type##_le, NEEDS_PEEK }, \
+    { "read_" #name "_be", hc_memory_read_##type##_be, NEEDS_PEEK }, \
+    { "write_" #name "_le", hc_memory_write_##type##_le, NEEDS_POKE }, \
+    { "write_" #name "_be", hc_memory_write_##type##_be, NEEDS_POKE }
+
+static const hc_method_t memory_methods[] = {
+    { "peek", memory_peek, NEEDS_PEEK },
+    { "read_bytes", memory_read_bytes, NEEDS_PEEK },
+    { "read_byte", hc_memory_read_byte, NEEDS_PEEK },
+    { "read_char", hc_memory_read_char, NEEDS_PEEK },
+    { "poke", memory_poke, NEEDS_POKE },
+    { "write_bytes", memory_write_bytes, NEEDS_POKE },
+    { "write_byte", hc_memory_write_byte, NEEDS_POKE },
+    { "write_char", hc_memory_write_char, NEEDS_POKE },
+    { "set", memory_memset, NEEDS_POKE },
+    { "cpy", memory_memcpy, NEEDS_PEEK | NEEDS_POKE },
+    { "swap", memory_memswap, NEEDS_PEEK | NEEDS_POKE },
+    { "set_watchpoint", memory_set_watchpoint, 0 },
+    MEMORY_ACCESS_METHODS(int16, int16_t),
+    MEMORY_ACCESS_METHODS(uint16, uint16_t),
+    MEMORY_ACCESS_METHODS(int32, int32_t),
+    MEMORY_ACCESS_METHODS(uint32, uint32_t),
+    MEMORY_ACCESS_METHODS(int64, int64_t),
+    MEMORY_ACCESS_METHODS(uint64, uint64_t),
+    MEMORY_ACCESS_METHODS(float32, float),
+    MEMORY_ACCESS_METHODS(float64, double),
+};
+
+static const hc_method_t cpu_methods[] = {
+    { "step_into", cpu_step_into, 0 },
+    { "step_over", cpu_step_over, 0 },
+    { "step_out", cpu_step_out, 0 },
+    { "set_exec_breakpoint", cpu_set_exec_breakpoint, 0 },
+    { "get_registers", cpu_get_registers, NEEDS_GET_REGISTER },
+    { "set_registers", cpu_set_registers, NEEDS_SET_REGISTER },
+    { "start_trace", cpu_start_trace, 0 },
+    { "stop_trace", cpu_stop_trace, 0 },
+    { "read_trace", cpu_read_trace, 0 },
+    { "dump_trace", cpu_dump_trace, 0 },
+};
+
+static const hc_method_t register_methods[] = {
+    { "get", get_register, NEEDS_GET_REGISTER },
+    { "set", set_register, NEEDS_SET_REGISTER },
+    { "watch", set_register_breakpoint, 0 },
+};
+
+// pushes the method with the given name if available (returns 1), otherwise returns 0.
+// the method is a closure over the top num_upvalues values on the stack, which are popped either way.
+static int push_method(lua_State* L, hc_method_t const* methods, size_t num_methods, const char* name, unsigned available, int num_upvalues)
+{
+    for (size_t i = 0; i < num_methods; ++i)
     {
-        lua_pushlightuserdata(L, (void*)mem);
-        lua_rawsetfield(L, -2, USERDATA_FIELD);
-        
-        if (mem->v1.id)
+        if (!strcmp(methods[i].name, name))
         {
-            lua_pushstring(L, mem->v1.id);
-            lua_rawsetfield(L, -2, "id");
+            if ((methods[i].needs & available) != methods[i].needs) break;
+            lua_pushcclosure(L, methods[i].func, num_upvalues);
+            return 1;
         }
-        
-        if (mem->v1.description)
+    }
+    lua_pop(L, num_upvalues);
+    return 0;
+}
+
+// stores the value on top of the stack in self under key, leaving the value on the stack.
+static int cache_field(lua_State* L)
+{
+    lua_pushvalue(L, 2);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, 1);
+    return 1;
+}
+
+// sets the metatable with the given registry name (creating it if necessary) on the table at the top of the stack.
+static void set_shared_metatable(lua_State* L, const char* name, lua_CFunction index)
+{
+    if (!luaL_getsubtable(L, LUA_REGISTRYINDEX, name))
+    {
+        lua_pushcfunction(L, index);
+        lua_rawsetfield(L, -2, "__index");
+    }
+    lua_setmetatable(L, -2);
+}
+
+static void push_breakpoints(lua_State* L, hc_GenericBreakpoint const* const* break_points, unsigned num_break_points)
+{
+    lua_createtable(L, num_break_points, 0);
+    for (size_t i = 0; i < num_break_points; ++i)
+    {
+        if (break_points[i])
         {
-            lua_pushstring(L, mem->v1.description);
-            lua_rawsetfield(L, -2, "description");
+            (void)push_breakpoint(L, break_points[i]);
+            lua_rawseti(L, -2, i + 1);
         }
-        
+    }
+}
+
+// lua args: self, key
+static int memory_index(lua_State* L)
+{
+    hc_Memory const* mem = (hc_Memory const*)get_userdata_from_self(L);
+    if (!mem || !lua_isstring(L, 2)) return 0;
+    const char* key = lua_tostring(L, 2);
+    
+    if (!strcmp(key, "id"))
+    {
+        if (!mem->v1.id) return 0;
+        lua_pushstring(L, mem->v1.id);
+    }
+    else if (!strcmp(key, "description"))
+    {
+        if (!mem->v1.description) return 0;
+        lua_pushstring(L, mem->v1.description);
+    }
+    else if (!strcmp(key, "alignment"))
+    {
         lua_pushinteger(L, mem->v1.alignment);
-        lua_rawsetfield(L, -2, "alignment");
-        
+    }
+    else if (!strcmp(key, "base_address"))
+    {
         lua_pushinteger(L, mem->v1.base_address);
-        lua_rawsetfield(L, -2, "base_address");
-        
+    }
+    else if (!strcmp(key, "size"))
+    {
         lua_pushinteger(L, mem->v1.size);
-        lua_rawsetfield(L, -2, "size");
-        
-        #define FUNCFIELD(name, f) lua_pushcfunction(L, f); lua_rawsetfield(L, -2, #name);
-        #define MEMFIELD(read, name, type) \
-            FUNCFIELD(read##_##name##_le, hc_memory_##read##_##type##_le); \
-            FUNCFIELD(read##_##name##_be, hc_memory_##read##_##type##_be)
+    }
+    else if (!strcmp(key, "breakpoints"))
+    {
+        push_breakpoints(L, mem->v1.break_points, mem->v1.num_break_points);
+    }
+    else
+    {
+        const unsigned available = (mem->v1.peek ? NEEDS_PEEK : 0) | (mem->v1.poke ? NEEDS_POKE : 0);
+        lua_pushlightuserdata(L, (void*)mem);
+        if (!push_method(L, memory_methods, sizeof(memory_methods) / sizeof(memory_methods[0]), key, available, 1)) return 0;
+    }
+    
+    return cache_field(L);
+}
+
+static int push_memory_region(lua_State* L, hc_Memory const* mem)
+{
+    if (lua_table_for_data(L, mem))
+    {
+        lua_pushlightuserdata(L, (void*)mem);
+        lua_rawsetfield(L, -2, USERDATA_FIELD);
+        set_shared_metatable(L, "retro_script_hc_memory", memory_index);
+    }
+    
+    return 1;
+}
+
+// lua args: self, key
+static int register_index(lua_State* L)
+{
+    hc_Cpu const* cpu = (hc_Cpu const*)get_userdata_from_self(L);
+    if (!cpu || !lua_isstring(L, 2)) return 0;
+    
+    lua_Integer idx;
+    if (!get_register_index(L, &idx)) return 0;
+    
+    const unsigned available = (cpu->v1.get_register ? NEEDS_GET_REGISTER : 0) | (cpu->v1.set_register ? NEEDS_SET_REGISTER : 0);
+    lua_pushlightuserdata(L, (void*)cpu);
+    lua_pushinteger(L, idx);
+    if (!push_method(L, register_methods, sizeof(register_methods) / sizeof(register_methods[0]), lua_tostring(L, 2), available, 2)) return 0;
+    
+    return cache_field(L);
+}
+
+static void push_registers(lua_State* L, hc_Cpu const* cpu)
+{
+    const int num_registers = retro_script_hc_get_cpu_register_count(cpu->v1.type);
+    lua_createtable(L, num_registers, 0);
+    for (size_t i = 0; i < num_registers; ++i)
+    {
+        lua_createtable(L, 0, 3);
         
-        if (mem->v1.peek)
-        {
-            lua_pushcfunction(L, memory_peek);
-            lua_rawsetfield(L, -2, "peek");
-            FUNCFIELD(read_byte, hc_memory_read_byte);
-            FUNCFIELD(read_char, hc_memory_read_char);
-            MEMFIELD(read, int16, int16_t);
-            MEMFIELD(read, uint16, uint16_t);
-            MEMFIELD(read, int32, int32_t);
-            MEMFIELD(read, uint32, uint32_t);
-            MEMFIELD(read, int64, int64_t);
-            MEMFIELD(read, uint64, uint64_t);
-            MEMFIELD(read, float32, float);
-            MEMFIELD(read, float64, double);
-        }
+        lua_pushlightuserdata(L, (void*)cpu);
+        lua_rawsetfield(L, -2, USERDATA_FIELD);
         
-        if (mem->v1.poke)
-        {
-            lua_pushcfunction(L, memory_poke);
-            lua_rawsetfield(L, -2, "poke");
-            FUNCFIELD(read_byte, hc_memory_write_byte);
-            FUNCFIELD(read_char, hc_memory_write_char);
-            MEMFIELD(write, int16, int16_t);
-            MEMFIELD(write, uint16, uint16_t);
-            MEMFIELD(write, int32, int32_t);
-            MEMFIELD(write, uint32, uint32_t);
-            MEMFIELD(write, int64, int64_t);
-            MEMFIELD(write, uint64, uint64_t);
-            MEMFIELD(write, float32, float);
-            MEMFIELD(write, float64, double);
-            lua_pushcfunction(L, memory_memset);
-            lua_rawsetfield(L, -2, "set");
-        }
+        lua_pushinteger(L, i);
+        lua_rawsetfield(L, -2, "_idx");
         
-        if (mem->v1.poke && mem->v1.peek)
+        const char* name = retro_script_hc_get_cpu_register_name(cpu->v1.type, i);
+        if (name)
         {
-            lua_pushcfunction(L, memory_memcpy);
-            lua_rawsetfield(L, -2, "cpy");
+            lua_pushstring(L, name);
+            lua_rawsetfield(L, -2, "name");
             
-            lua_pushcfunction(L, memory_memswap);
-            lua_rawsetfield(L, -2, "swap");
-        }
-        
-        lua_pushcfunction(L, memory_set_watchpoint);
-        lua_rawsetfield(L, -2, "set_watchpoint");
-        
-        lua_createtable(L, mem->v1.num_break_points, 0);
-        for (size_t i = 0; i < mem->v1.num_break_points; ++i)
-        {
-            if (mem->v1.break_points[i])
+            // register name as key for register, e.g. registers.X
+            if (*name)
             {
-                (void)push_breakpoint(L, mem->v1.break_points[i]);
-                lua_rawseti(L, -2, i + 1);
+                lua_pushvalue(L, -1);
+                lua_rawsetfield(L, -3, name);
             }
         }
-        lua_rawsetfield(L, -2, "breakpoints");
+        
+        set_shared_metatable(L, "retro_script_hc_register", register_index);
+        lua_rawseti(L, -2, i + 1);
     }
+}
+
+// lua args: self, key
+static int cpu_index(lua_State* L)
+{
+    hc_Cpu const* cpu = (hc_Cpu const*)get_userdata_from_self(L);
+    if (!cpu || !lua_isstring(L, 2)) return 0;
+    const char* key = lua_tostring(L, 2);
     
-    return 1;
+    if (!strcmp(key, "description"))
+    {
+        if (!cpu->v1.description) return 0;
+        lua_pushstring(L, cpu->v1.description);
+    }
+    else if (!strcmp(key, "type"))
+    {
+        lua_pushinteger(L, cpu->v1.type);
+    }
+    else if (!strcmp(key, "name"))
+    {
+        const char* cpu_name = retro_script_hc_get_cpu_name(cpu->v1.type);
+        if (!cpu_name) return 0;
+        lua_pushstring(L, cpu_name);
+    }
+    else if (!strcmp(key, "registers"))
+    {
+        if (retro_script_hc_get_cpu_register_count(cpu->v1.type) < 0) return 0;
+        push_registers(L, cpu);
+    }
+    else if (!strcmp(key, "is_main"))
+    {
+        if (!cpu->v1.is_main) return 0;
+        lua_pushinteger(L, 1);
+    }
+    else if (!strcmp(key, "memory"))
+    {
+        if (!cpu->v1.memory_region) return 0;
+        push_memory_region(L, cpu->v1.memory_region);
+    }
+    else if (!strcmp(key, "breakpoints"))
+    {
+        push_breakpoints(L, cpu->v1.break_points, cpu->v1.num_break_points);
+    }
+    else
+    {
+        const unsigned available = (cpu->v1.get_register ? NEEDS_GET_REGISTER : 0) | (cpu->v1.set_register ? NEEDS_SET_REGISTER : 0);
+        lua_pushlightuserdata(L, (void*)cpu);
+        if (!push_method(L, cpu_methods, sizeof(cpu_methods) / sizeof(cpu_methods[0]), key, available, 1)) return 0;
+    }
+    
+    return cache_field(L);
 }
 
 static int push_cpu(lua_State* L, hc_Cpu const* cpu)
@@ -750,109 +1577,9 @@ static int push_cpu(lua_State* L, hc_Cpu const* cpu)
     {
         lua_pushlightuserdata(L, (void*)cpu);
         lua_rawsetfield(L, -2, USERDATA_FIELD);
-                
-        if (cpu->v1.description)
-        {
-            lua_pushstring(L, cpu->v1.description);
-            lua_rawsetfield(L, -2, "description");
-        }
-        
-        lua_pushinteger(L, cpu->v1.type);
-        lua_rawsetfield(L, -2, "type");
-        
-        const char* cpu_name = retro_script_hc_get_cpu_name(cpu->v1.type);
-        if (cpu_name)
-        {
-            lua_pushstring(L, cpu_name);
-            lua_rawsetfield(L, -2, "name");
-        }
-        
-        // registers
-        const int num_registers = retro_script_hc_get_cpu_register_count(cpu->v1.type);
-        if (num_registers >= 0)
-        {
-            lua_newtable(L);
-            for (size_t i = 0; i < num_registers; ++i)
-            {
-                lua_newtable(L);
-                
-                lua_pushlightuserdata(L, (void*)cpu);
-                lua_rawsetfield(L, -2, USERDATA_FIELD);
-                
-                lua_pushinteger(L, i);
-                lua_rawsetfield(L, -2, "_idx");
-                
-                const char* name = retro_script_hc_get_cpu_register_name(cpu->v1.type, i);
-                if (name)
-                {
-                    lua_pushstring(L, name);
-                    lua_rawsetfield(L, -2, "name");
-                    
-                    // register name as key for register, e.g. registers.X
-                    if (*name)
-                    {
-                        lua_pushvalue(L, -1);
-                        lua_rawsetfield(L, -3, name);
-                    }
-                }
-                    
-                if (cpu->v1.get_register)
-                {
-                    lua_pushcfunction(L, get_register);
-                    lua_rawsetfield(L, -2, "get");
-                }
-                
-                if (cpu->v1.set_register)
-                {
-                    lua_pushcfunction(L, set_register);
-                    lua_rawsetfield(L, -2, "set");
-                }
-                
-                lua_pushcfunction(L, set_register_breakpoint);
-                lua_rawsetfield(L, -2, "watch");
-                
-                lua_rawseti(L, -2, i + 1);
-            }
-            
-            lua_rawsetfield(L, -2, "registers");
-        }
-        
-        if (cpu->v1.is_main)
-        {
-            lua_pushinteger(L, 1);
-            lua_rawsetfield(L, -2, "is_main");
-        }
-        
-        if (cpu->v1.memory_region)
-        {
-            push_memory_region(L, cpu->v1.memory_region);
-            lua_rawsetfield(L, -2, "memory");
-        }
-        
-        lua_pushcfunction(L, cpu_step_into);
-        lua_rawsetfield(L, -2, "step_into");
-        
-        lua_pushcfunction(L, cpu_step_over);
-        lua_rawsetfield(L, -2, "step_over");
-        
-        lua_pushcfunction(L, cpu_step_out);
-        lua_rawsetfield(L, -2, "step_out");
-        
-        lua_pushcfunction(L, cpu_set_exec_breakpoint);
-        lua_rawsetfield(L, -2, "set_exec_breakpoint");
-        
-        lua_createtable(L, cpu->v1.num_break_points, 0);
-        for (size_t i = 0; i < cpu->v1.num_break_points; ++i)
-        {
-            if (cpu->v1.break_points[i])
-            {
-                (void)push_breakpoint(L, cpu->v1.break_points[i]);
-                lua_rawseti(L, -2, i + 1);
-            }
-        }
-        lua_rawsetfield(L, -2, "breakpoints");
+        set_shared_metatable(L, "retro_script_hc_cpu", cpu_index);
     }
-        
+    
     return 1;
 }
 
@@ -913,10 +1640,12 @@ int retro_script_luafunc_hc_system_get_cpus(lua_State* L)
 int retro_script_luafunc_hc_breakpoint_clear(lua_State* L)
 {
     assert_argc(L, 1);
-    const unsigned int breakpoint_id = lua_tointeger(L, 1);
-    const unsigned int was_removed = retro_script_hc_unregister_breakpoint(breakpoint_id);
+    const hc_SubscriptionID breakpoint_id = lua_tointeger(L, 1);
+    const bool was_removed = !retro_script_hc_unregister_breakpoint(breakpoint_id);
     if (was_removed)
     {
+        if (debugger->v1.unsubscribe) debugger->v1.unsubscribe(breakpoint_id);
+        remove_deferred_subscription(breakpoint_id);
         lua_pushinteger(L, 1);
     }
     else
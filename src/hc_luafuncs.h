@@ -1,6 +1,7 @@
 #pragma once
 
 struct lua_State;
+struct script_state;
 
 // c functions callable from lua
 int retro_script_luafunc_hc_system_get_description(struct lua_State* L);
@@ -9,6 +10,15 @@ int retro_script_luafunc_hc_system_get_breakpoints(struct lua_State* L);
 int retro_script_luafunc_hc_system_get_cpus(struct lua_State* L);
 int retro_script_luafunc_hc_breakpoint_clear(struct lua_State* L);
 
+// lua args: [enable], [capacity]
+int retro_script_luafunc_hc_defer_events(struct lua_State* L);
+
+// passes the events queued by deferred subscriptions to lua. Called after the core runs a frame.
+void retro_script_hc_deliver_events();
+
+// removes the deferred subscriptions of the given script.
+void retro_script_hc_free_events(struct script_state*);
+
 // field setters
 
 // sets "main_cpu" and "main_memory"
@@ -0,0 +1,245 @@
+#include "l.h"
+#include "hc_trace.h"
+#include "hc_hooks.h"
+#include "core.h"
+#include "util.h"
+
+#include <stdio.h>
+
+typedef struct hc_trace
+{
+    retro_script_id_t script;
+    hc_Cpu const* cpu;
+    
+    // -1 while not recording.
+    hc_SubscriptionID id;
+    
+    unsigned* registers;
+    size_t num_registers;
+    
+    // ring buffer of capacity records, each stride values.
+    uint64_t* records;
+    size_t stride;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    
+    // number of records overwritten since the last read.
+    uint64_t dropped;
+    
+    struct hc_trace* next;
+} hc_trace_t;
+
+static hc_trace_t* traces = NULL;
+
+static void free_trace(hc_trace_t* trace)
+{
+    if (trace->registers) free(trace->registers);
+    if (trace->records) free(trace->records);
+    free(trace);
+}
+
+// (the core's subscriptions end with it.)
+ON_DEINIT()
+{
+    while (traces)
+    {
+        hc_trace_t* next = traces->next;
+        free_trace(traces);
+        traces = next;
+    }
+}
+
+static hc_trace_t* find_trace(retro_script_id_t script, hc_Cpu const* cpu)
+{
+    for (hc_trace_t* trace = traces; trace; trace = trace->next)
+    {
+        if (trace->script == script && trace->cpu == cpu) return trace;
+    }
+    return NULL;
+}
+
+// called for every instruction executed, so this is kept as small as possible.
+static void on_trace_event(retro_script_hc_breakpoint_userdata u, hc_SubscriptionID id, hc_Event const* e)
+{
+    hc_trace_t* trace = (hc_trace_t*)u.values[0].ptr;
+    if (e->type != HC_EVENT_EXECUTION) return;
+    
+    // when full, the oldest record is overwritten.
+    size_t tail = trace->head + trace->count;
+    if (tail >= trace->capacity) tail -= trace->capacity;
+    if (trace->count == trace->capacity)
+    {
+        if (++trace->head == trace->capacity) trace->head = 0;
+        ++trace->dropped;
+    }
+    else
+    {
+        ++trace->count;
+    }
+    
+    uint64_t* record = &trace->records[trace->stride * tail];
+    record[0] = e->execution.address;
+    for (size_t i = 0; i < trace->num_registers; ++i)
+    {
+        record[i + 1] = trace->cpu->v1.get_register(trace->registers[i]);
+    }
+}
+
+static void stop_trace(hc_trace_t* trace)
+{
+    if (trace->id < 0) return;
+    retro_script_hc_unregister_breakpoint(trace->id);
+    hc_DebuggerIf* debugger = retro_script_hc_get_debugger();
+    if (debugger && debugger->v1.unsubscribe) debugger->v1.unsubscribe(trace->id);
+    trace->id = -1;
+}
+
+// removes the traces matching the given script, and cpu (if not NULL).
+static void remove_traces(retro_script_id_t script, hc_Cpu const* cpu)
+{
+    hc_trace_t** trace = &traces;
+    while (*trace)
+    {
+        if ((*trace)->script == script && (!cpu || (*trace)->cpu == cpu))
+        {
+            hc_trace_t* next = (*trace)->next;
+            stop_trace(*trace);
+            free_trace(*trace);
+            *trace = next;
+        }
+        else
+        {
+            trace = &(*trace)->next;
+        }
+    }
+}
+
+bool retro_script_hc_trace_start(retro_script_id_t script, hc_Cpu const* cpu, size_t capacity, unsigned const* registers, size_t num_registers)
+{
+    hc_DebuggerIf* debugger = retro_script_hc_get_debugger();
+    if (!debugger || !debugger->v1.subscribe || !cpu || capacity == 0) return false;
+    if (num_registers > 0 && !cpu->v1.get_register) return false;
+    
+    remove_traces(script, cpu);
+    
+    const size_t stride = 1 + num_registers;
+    if (capacity > SIZE_MAX / sizeof(uint64_t) / stride) return false;
+    
+    hc_trace_t* trace = alloc(hc_trace_t);
+    if (!trace) return false;
+    memset(trace, 0, sizeof(*trace));
+    trace->id = -1;
+    trace->script = script;
+    trace->cpu = cpu;
+    trace->stride = stride;
+    trace->capacity = capacity;
+    trace->num_registers = num_registers;
+    trace->records = malloc_array(uint64_t, stride * capacity);
+    trace->registers = malloc_array(unsigned, num_registers ? num_registers : 1);
+    if (!trace->records || !trace->registers)
+    {
+        free_trace(trace);
+        return false;
+    }
+    memcpy(trace->registers, registers, sizeof(unsigned) * num_registers);
+    
+    hc_Subscription s;
+    s.type = HC_EVENT_EXECUTION;
+    s.execution.cpu = cpu;
+    s.execution.type = HC_STEP;
+    s.execution.address_range_begin = 0;
+    s.execution.address_range_end = -1;
+    
+    trace->id = debugger->v1.subscribe(&s);
+    if (trace->id < 0)
+    {
+        free_trace(trace);
+        return false;
+    }
+    
+    retro_script_hc_breakpoint_userdata u;
+    u.values[0].ptr = trace;
+    u.values[1].u64 = 0;
+    if (retro_script_hc_register_breakpoint(&u, trace->id, on_trace_event))
+    {
+        if (debugger->v1.unsubscribe) debugger->v1.unsubscribe(trace->id);
+        free_trace(trace);
+        return false;
+    }
+    
+    trace->next = traces;
+    traces = trace;
+    return true;
+}
+
+bool retro_script_hc_trace_stop(retro_script_id_t script, hc_Cpu const* cpu)
+{
+    hc_trace_t* trace = find_trace(script, cpu);
+    if (!trace || trace->id < 0) return false;
+    stop_trace(trace);
+    return true;
+}
+
+static void clear_trace(hc_trace_t* trace)
+{
+    trace->head = 0;
+    trace->count = 0;
+    trace->dropped = 0;
+}
+
+// the records, oldest first, are count0 records from the head, then count1 from the start of the buffer.
+static void get_spans(hc_trace_t const* trace, size_t* count0, size_t* count1)
+{
+    *count0 = trace->capacity - trace->head;
+    if (*count0 > trace->count) *count0 = trace->count;
+    *count1 = trace->count - *count0;
+}
+
+int retro_script_hc_trace_push(lua_State* L, retro_script_id_t script, hc_Cpu const* cpu, bool clear)
+{
+    hc_trace_t* trace = find_trace(script, cpu);
+    if (!trace) return 0;
+    
+    size_t count0, count1;
+    get_spans(trace, &count0, &count1);
+    const size_t record_size = sizeof(uint64_t) * trace->stride;
+    lua_pushlstring(L, (const char*)&trace->records[trace->stride * trace->head], record_size * count0);
+    if (count1 > 0)
+    {
+        lua_pushlstring(L, (const char*)trace->records, record_size * count1);
+        lua_concat(L, 2);
+    }
+    lua_pushinteger(L, trace->count);
+    lua_pushinteger(L, trace->dropped);
+    
+    if (clear) clear_trace(trace);
+    return 3;
+}
+
+int64_t retro_script_hc_trace_dump(retro_script_id_t script, hc_Cpu const* cpu, const char* path, bool clear)
+{
+    hc_trace_t* trace = find_trace(script, cpu);
+    if (!trace) return -1;
+    
+    FILE* file = fopen(path, "wb");
+    if (!file) return -1;
+    
+    size_t count0, count1;
+    get_spans(trace, &count0, &count1);
+    const size_t record_size = sizeof(uint64_t) * trace->stride;
+    bool written = fwrite(&trace->records[trace->stride * trace->head], record_size, count0, file) == count0;
+    written = written && fwrite(trace->records, record_size, count1, file) == count1;
+    written = (fclose(file) == 0) && written;
+    if (!written) return -1;
+    
+    const int64_t count = trace->count;
+    if (clear) clear_trace(trace);
+    return count;
+}
+
+void retro_script_hc_free_traces(script_state_t* script)
+{
+    if (!script) return;
+    remove_traces(script->id, NULL);
+}
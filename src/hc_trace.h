@@ -0,0 +1,40 @@
+#pragma once
+
+/* records the address of every instruction a cpu executes (and optionally a snapshot of some of its registers)
+ * into a preallocated ring buffer, entirely in C, so that a trace can be taken without calling into lua
+ * for each instruction.
+ *
+ * each record is (1 + number of registers) uint64 values in host byte order: the PC, then each register traced.
+ * when the buffer is full, the oldest records are overwritten.
+ */
+
+#include "script.h"
+
+#include <hcdebug.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct lua_State;
+
+// starts tracing the cpu for the given script, replacing any trace the script had of that cpu.
+// registers are the indices of the registers to record with each instruction.
+// returns false if unsuccessful.
+bool retro_script_hc_trace_start(retro_script_id_t script, hc_Cpu const* cpu, size_t capacity, unsigned const* registers, size_t num_registers);
+
+// stops recording; the records are kept until read or the trace is started again.
+// returns false if the cpu was not being traced.
+bool retro_script_hc_trace_stop(retro_script_id_t script, hc_Cpu const* cpu);
+
+// pushes the records as a string (oldest first), the number of records, and the number of records overwritten.
+// (if clear, the records are then discarded.)
+// returns the number of values pushed (0 if there is no trace).
+int retro_script_hc_trace_push(struct lua_State* L, retro_script_id_t script, hc_Cpu const* cpu, bool clear);
+
+// writes the records to the file at path, in the same format as retro_script_hc_trace_push.
+// returns the number of records written, or -1 if there is no trace or the file could not be written.
+int64_t retro_script_hc_trace_dump(retro_script_id_t script, hc_Cpu const* cpu, const char* path, bool clear);
+
+// stops and frees the traces of the given script.
+void retro_script_hc_free_traces(script_state_t*);
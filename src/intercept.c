@@ -4,7 +4,13 @@
 #include "script.h"
 #include "script_list.h"
 #include "memmap.h"
+#include "memsnapshot.h"
+#include "memfreeze.h"
+#include "memjournal.h"
+#include "memexport.h"
+#include "memtrigger.h"
 #include "hc_hooks.h"
+#include "hc_luafuncs.h"
 #include "core.h"
 #include "error.h"
 #include "lram.h"
@@ -38,6 +44,20 @@ static size_t retro_script_core_deinit_count = 0;
 static core_init_cb_t core_on_init_fn[MAX_INIT_FUNCTIONS];
 static core_init_cb_t core_on_deinit_fn[MAX_INIT_FUNCTIONS];
 
+// set once the core provides its own memory map, which then takes precedence over the synthesized one.
+bool retro_script_memory_map_from_core = false;
+
+// memory regions which the synthesized memory map was last built from.
+#define NUM_SYNTHESIZED_REGIONS 3
+static void* synthesized_data[NUM_SYNTHESIZED_REGIONS];
+static size_t synthesized_size[NUM_SYNTHESIZED_REGIONS];
+
+static void forget_synthesized_memory_map()
+{
+    memset(synthesized_data, 0, sizeof(synthesized_data));
+    memset(synthesized_size, 0, sizeof(synthesized_size));
+}
+
 // registers functions to run on init
 void retro_script_register_on_init(core_init_cb_t cb)
 {
@@ -64,6 +84,8 @@ uint32_t retro_script_init()
         memset(&core, 0, sizeof(core));
         memset(&frontend_callbacks, 0, sizeof(frontend_callbacks));
         retro_script_clear_memory_map();
+        forget_synthesized_memory_map();
+        retro_script_memory_map_from_core = false;
     }
     else
     {
@@ -90,6 +112,8 @@ void retro_script_deinit()
             core_on_deinit_fn[i]();
         }
         retro_script_clear_memory_map();
+        forget_synthesized_memory_map();
+        retro_script_memory_map_from_core = false;
     }
 
     state = RS_DEINIT;
@@ -119,13 +143,90 @@ static void retro_check_intercepts()
     }
 }
 
+// many cores never provide a memory map; for those, one is built from retro_get_memory_data,
+// with system ram at address 0, then save ram and video ram (in their own addrspaces), each at the
+// next power of two past the end of the previous region, so that no two regions share an address.
+// this is rebuilt whenever the core's regions move (e.g. once a game is loaded).
+static void synthesize_memory_map()
+{
+    if (retro_script_memory_map_from_core || !core.retro_get_memory_data || !core.retro_get_memory_size) return;
+    
+    static const unsigned ids[NUM_SYNTHESIZED_REGIONS] = {
+        RETRO_MEMORY_SYSTEM_RAM, RETRO_MEMORY_SAVE_RAM, RETRO_MEMORY_VIDEO_RAM
+    };
+    static const char* const addrspaces[NUM_SYNTHESIZED_REGIONS] = {
+        NULL, "SAVE_RAM", "VIDEO_RAM"
+    };
+    
+    void* data[NUM_SYNTHESIZED_REGIONS];
+    size_t size[NUM_SYNTHESIZED_REGIONS];
+    bool changed = false;
+    for (size_t i = 0; i < NUM_SYNTHESIZED_REGIONS; ++i)
+    {
+        data[i] = core.retro_get_memory_data(ids[i]);
+        size[i] = data[i] ? core.retro_get_memory_size(ids[i]) : 0;
+        if (!size[i]) data[i] = NULL;
+        changed = changed || data[i] != synthesized_data[i] || size[i] != synthesized_size[i];
+    }
+    if (!changed) return;
+    
+    memcpy(synthesized_data, data, sizeof(data));
+    memcpy(synthesized_size, size, sizeof(size));
+    
+    struct retro_memory_descriptor descriptors[NUM_SYNTHESIZED_REGIONS];
+    struct retro_memory_map map;
+    memset(descriptors, 0, sizeof(descriptors));
+    map.descriptors = descriptors;
+    map.num_descriptors = 0;
+    size_t end = 0;
+    for (size_t i = 0; i < NUM_SYNTHESIZED_REGIONS; ++i)
+    {
+        if (!data[i]) continue;
+        size_t start = 0;
+        if (end > 0)
+        {
+            start = 1;
+            while (start && start < end) start <<= 1;
+            if (!start || size[i] > SIZE_MAX - start) break;
+        }
+        end = start + size[i];
+        
+        struct retro_memory_descriptor* descriptor = &descriptors[map.num_descriptors++];
+        descriptor->ptr = data[i];
+        descriptor->start = start;
+        descriptor->len = size[i];
+        descriptor->addrspace = addrspaces[i];
+    }
+    
+    if (map.num_descriptors)
+    {
+        retro_script_set_memory_map(&map);
+    }
+    else
+    {
+        retro_script_clear_memory_map();
+    }
+}
+
 static void INTERCEPT_HANDLER(retro_run)(void)
 {
+    synthesize_memory_map();
+    retro_script_journal_begin();
     SCRIPT_ITERATE(script_state)
     {
+        retro_script_journal_active = script_state->defer_writes;
         retro_script_execute_cb(script_state, script_state->refs.on_run_begin);
     }
+    retro_script_journal_active = false;
+    retro_script_journal_apply();
+    retro_script_memory_freeze_apply();
+    retro_script_memory_snapshot_before_run();
     core.retro_run();
+    retro_script_memory_snapshot_after_run();
+    retro_script_memory_freeze_apply();
+    retro_script_memory_export_after_run();
+    retro_script_hc_deliver_events();
+    retro_script_memory_triggers_after_run();
     SCRIPT_ITERATE(script_state)
     {
         retro_script_execute_cb(script_state, script_state->refs.on_run_end);
@@ -139,6 +240,7 @@ static bool retro_environment(unsigned int cmd, void* data)
     switch (cmd)
     {
     case RETRO_ENVIRONMENT_SET_MEMORY_MAPS:
+        retro_script_memory_map_from_core = true;
         result = retro_script_set_memory_map((struct retro_memory_map*)data);
         break;
     case RETRO_ENVIRONMENT_SET_PROC_ADDRESS_CALLBACK:
@@ -162,6 +264,7 @@ static void INTERCEPT_HANDLER(retro_init)(void)
     retro_check_intercepts();
     core.retro_init();
     state = CORE_INIT;
+    synthesize_memory_map();
 }
 
 static void INTERCEPT_HANDLER(retro_deinit)(void)
@@ -169,6 +272,13 @@ static void INTERCEPT_HANDLER(retro_deinit)(void)
     assert(state == CORE_INIT);
     core.retro_deinit();
     state = CORE_DEINIT;
+    
+    // the core's memory is no longer valid.
+    if (!retro_script_memory_map_from_core)
+    {
+        retro_script_clear_memory_map();
+        forget_synthesized_memory_map();
+    }
 }
 
 static void INTERCEPT_HANDLER(retro_set_input_poll)(retro_input_poll_t cb)
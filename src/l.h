@@ -29,6 +29,8 @@ typedef int (*lua_KFunction) (lua_State *L, int status, lua_KContext ctx);
 #define lua_tonumberx(L, idx, pisnum)   (((lua_Number(*)(lua_State *, int, int *))retro_script_lua_api_global.lua_tonumberx)(L, idx, pisnum))
 #define lua_tolstring(L, idx, len)      (((const char*(*)(lua_State*L, int, size_t*))retro_script_lua_api_global.lua_tolstring)(L, idx, len))
 #define lua_touserdata(L, idx)          (((void*(*)(lua_State*, int))retro_script_lua_api_global.lua_touserdata)(L, idx))
+#define lua_newuserdatauv(L, sz, nuv)   (((void*(*)(lua_State*, size_t, int))retro_script_lua_api_global.lua_newuserdatauv)(L, sz, nuv))
+#define lua_toboolean(L, idx)           (((int(*)(lua_State*, int))retro_script_lua_api_global.lua_toboolean)(L, idx))
 #define lua_next(L, idx)                (((int(*)(lua_State*, int))retro_script_lua_api_global.lua_next)(L, idx))
 #define lua_typename(L, tp)             (((const char*(*)(lua_State *, int))retro_script_lua_api_global.lua_typename)(L, tp))
 #define lua_isinteger(L, idx)           (((int(*)(lua_State *L, int))retro_script_lua_api_global.lua_isinteger)(L, idx))
@@ -41,6 +43,7 @@ typedef int (*lua_KFunction) (lua_State *L, int status, lua_KContext ctx);
 #define lua_pushinteger(L, n)           (((void(*)(lua_State *, lua_Integer))retro_script_lua_api_global.lua_pushinteger)(L, n))
 #define lua_pushnumber(L, v)            (((void(*)(lua_State *, lua_Number))retro_script_lua_api_global.lua_pushnumber)(L, v))
 #define lua_pushlightuserdata(L, p)     (((void(*)(lua_State *, void *))retro_script_lua_api_global.lua_pushlightuserdata)(L, p))
+#define lua_pushlstring(L, s, len)      (((const char*(*)(lua_State *, const char*, size_t))retro_script_lua_api_global.lua_pushlstring)(L, s, len))
 #define lua_pushstring(L, s)            (((const char*(*)(lua_State *, const char*))retro_script_lua_api_global.lua_pushstring)(L, s))
 #define lua_pushcclosure(L, fn, n)      (((void(*)(lua_State *, lua_CFunction, int))retro_script_lua_api_global.lua_pushcclosure)(L, fn, n))
 #define lua_rawgeti(L, idx, n)          (((int(*)(lua_State *, int, lua_Integer))retro_script_lua_api_global.lua_rawgeti)(L, idx, n))
@@ -48,6 +51,7 @@ typedef int (*lua_KFunction) (lua_State *L, int status, lua_KContext ctx);
 #define lua_rawget(L, idx)              (((int(*)(lua_State *, int))retro_script_lua_api_global.lua_rawget)(L, idx))
 #define lua_rawset(L, idx)              (((void(*)(lua_State *, int))retro_script_lua_api_global.lua_rawset)(L, idx))
 #define lua_setfield(L, idx, k)         (((void(*)(lua_State *, int, char const*))retro_script_lua_api_global.lua_setfield)(L, idx, k))
+#define lua_setmetatable(L, objindex)   (((int(*)(lua_State *, int))retro_script_lua_api_global.lua_setmetatable)(L, objindex))
 #define lua_close(L)                    (((void(*)(lua_State *))retro_script_lua_api_global.lua_close)(L))
 #define lua_concat(L, n)                (((void(*)(lua_State *, int))retro_script_lua_api_global.lua_concat)(L, n))
 #define lua_rotate(L, idx, n)           (((void(*)(lua_State *, int, int))retro_script_lua_api_global.lua_rotate)(L, idx, n))
@@ -55,9 +59,11 @@ typedef int (*lua_KFunction) (lua_State *L, int status, lua_KContext ctx);
 #define lua_getglobal(L, name)          (((int(*)(lua_State *, const char*))retro_script_lua_api_global.lua_getglobal)(L, name))
 #define lua_rawlen(L, n)                (((lua_Unsigned(*)(lua_State *, int))retro_script_lua_api_global.lua_rawlen)(L, n))
 #define luaL_ref(L, t)                  (((int(*)(lua_State *, int))retro_script_lua_api_global.luaL_ref)(L, t))
+#define luaL_unref(L, t, ref)           (((void(*)(lua_State *, int, int))retro_script_lua_api_global.luaL_unref)(L, t, ref))
 #define luaL_error(L, ...)              (((int(*)(lua_State *, const char *, ...))retro_script_lua_api_global.luaL_error)(L, __VA_ARGS__))
 #define luaL_newstate()                 (((lua_State*(*)())retro_script_lua_api_global.luaL_newstate)())
 #define luaL_requiref(L, modname, openf, glb) (((void(*)(lua_State *, const char *, lua_CFunction, int))retro_script_lua_api_global.luaL_requiref)(L, modname, openf, glb))
+#define luaL_checkudata(L, ud, tname)   (((void*(*)(lua_State *, int, const char*))retro_script_lua_api_global.luaL_checkudata)(L, ud, tname))
 #define luaL_getsubtable(L, idx, fname) (((int(*)(lua_State *, int, const char*))retro_script_lua_api_global.luaL_getsubtable)(L, idx, fname))
 #define luaL_loadfilex(L, filename, mode) (((int(*)(lua_State *, const char *, const char *))retro_script_lua_api_global.luaL_loadfilex)(L, filename, mode))
 #define luaopen_base ((lua_CFunction)retro_script_lua_api_global.luaopen_base)
@@ -74,6 +80,7 @@ typedef int (*lua_KFunction) (lua_State *L, int status, lua_KContext ctx);
 #define lua_istable(L, idx) (lua_type(L, idx) == LUA_TTABLE)
 #define lua_isnil(L, idx) (lua_type(L, idx) == LUA_TNIL)
 #define lua_isnumber(L, idx) (lua_type(L, idx) == LUA_TNUMBER)
+#define lua_isboolean(L, idx) (lua_type(L, idx) == LUA_TBOOLEAN)
 #define lua_isfunction(L, idx) (lua_type(L, idx) == LUA_TFUNCTION)
 #define lua_pop(L, n) lua_settop(L, -(n)-1)
 #define lua_pcall(L,n,r,f)	lua_pcallk(L, (n), (r), (f), 0, NULL)
@@ -0,0 +1,363 @@
+#include "l.h"
+#include "memexport.h"
+#include "memmap.h"
+#include "script_list.h"
+#include "util.h"
+
+#include <stdint.h>
+
+#ifndef _WIN32
+    #define MEMEXPORT_POSIX
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// region data is aligned to this many bytes within the segment.
+#define EXPORT_ALIGN 64
+
+// where each region is copied from and to. (kept privately, as other processes can write to the segment.)
+typedef struct export_region
+{
+    const char* host;
+    size_t offset;
+    size_t len;
+} export_region_t;
+
+typedef struct memory_export
+{
+    char* name;
+    char* addrspace; // NULL to export every descriptor.
+    retro_script_id_t script;
+    int fd;
+    
+    retro_script_export_header_t* header; // the mapped segment, or NULL if it could not be laid out.
+    size_t mapped_size;
+    
+    // memory map generation the regions were laid out for.
+    uint32_t generation;
+    
+    size_t num_regions;
+    export_region_t* regions;
+    
+    struct memory_export* next;
+} memory_export_t;
+
+static memory_export_t* exports = NULL;
+
+static int _lua_error(lua_State* L, const char* message)
+{
+    return luaL_error(L, "%s", message);
+}
+
+#ifdef MEMEXPORT_POSIX
+
+static size_t align_up(size_t n)
+{
+    return (n + EXPORT_ALIGN - 1) & ~(size_t)(EXPORT_ALIGN - 1);
+}
+
+static retro_script_export_region_t* get_regions(retro_script_export_header_t* header)
+{
+    return (retro_script_export_region_t*)(header + 1);
+}
+
+// readers retry while the sequence number is odd, or if it changed while they were reading.
+static void sequence_begin(retro_script_export_header_t* header)
+{
+    __atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void sequence_end(retro_script_export_header_t* header)
+{
+    __atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELEASE);
+}
+
+static bool export_matches(memory_export_t const* export, struct retro_memory_descriptor const* descriptor)
+{
+    if (!descriptor->ptr || descriptor->len == 0) return false;
+    if (!export->addrspace) return true;
+    return !strcmp(export->addrspace, descriptor->addrspace ? descriptor->addrspace : "");
+}
+
+// lays out the segment for the current memory map, growing it if necessary.
+// must be followed by copying the regions, within the same sequence.
+static bool export_layout(memory_export_t* export)
+{
+    size_t num_descriptors;
+    struct retro_memory_descriptor const* descriptors = retro_script_memory_get_descriptors(&num_descriptors);
+    
+    const char** hosts = malloc_array(const char*, num_descriptors ? num_descriptors : 1);
+    size_t* indices = malloc_array(size_t, num_descriptors ? num_descriptors : 1);
+    export_region_t* copies = malloc_array(export_region_t, num_descriptors ? num_descriptors : 1);
+    if (!hosts || !indices || !copies) goto FAIL;
+    
+    // memory mirrored by several descriptors is only exported once.
+    size_t num_regions = 0;
+    for (size_t i = 0; i < num_descriptors; ++i)
+    {
+        struct retro_memory_descriptor const* descriptor = &descriptors[i];
+        if (!export_matches(export, descriptor)) continue;
+        
+        const char* host = (const char*)descriptor->ptr + descriptor->offset;
+        bool mirrored = false;
+        for (size_t k = 0; k < num_regions && !mirrored; ++k)
+        {
+            struct retro_memory_descriptor const* other = &descriptors[indices[k]];
+            mirrored = host >= hosts[k] && host + descriptor->len <= hosts[k] + other->len;
+        }
+        if (mirrored) continue;
+        
+        hosts[num_regions] = host;
+        indices[num_regions++] = i;
+    }
+    
+    size_t size = align_up(sizeof(retro_script_export_header_t) + sizeof(retro_script_export_region_t) * num_regions);
+    for (size_t k = 0; k < num_regions; ++k)
+    {
+        size = align_up(size + descriptors[indices[k]].len);
+    }
+    
+    // the segment only grows, so that readers which have not yet remapped it can still read the header.
+    if (size > export->mapped_size)
+    {
+        if (export->header) munmap(export->header, export->mapped_size);
+        export->header = NULL;
+        export->mapped_size = 0;
+        if (ftruncate(export->fd, (off_t)size) != 0) goto FAIL;
+        
+        void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, export->fd, 0);
+        if (mapped == MAP_FAILED) goto FAIL;
+        export->header = (retro_script_export_header_t*)mapped;
+        export->mapped_size = size;
+    }
+    
+    retro_script_export_header_t* header = export->header;
+    sequence_begin(header);
+    header->magic = RETRO_SCRIPT_EXPORT_MAGIC;
+    header->version = RETRO_SCRIPT_EXPORT_VERSION;
+    header->num_regions = (uint32_t)num_regions;
+    header->size = export->mapped_size;
+    
+    retro_script_export_region_t* regions = get_regions(header);
+    size_t offset = align_up(sizeof(retro_script_export_header_t) + sizeof(retro_script_export_region_t) * num_regions);
+    for (size_t k = 0; k < num_regions; ++k)
+    {
+        struct retro_memory_descriptor const* descriptor = &descriptors[indices[k]];
+        retro_script_export_region_t* region = &regions[k];
+        memset(region, 0, sizeof(*region));
+        region->start = descriptor->start;
+        region->select = descriptor->select;
+        region->disconnect = descriptor->disconnect;
+        region->len = descriptor->len;
+        region->offset = offset;
+        copies[k].host = hosts[k];
+        copies[k].offset = offset;
+        copies[k].len = descriptor->len;
+        if (descriptor->addrspace)
+        {
+            strncpy(region->addrspace, descriptor->addrspace, sizeof(region->addrspace) - 1);
+        }
+        offset = align_up(offset + descriptor->len);
+    }
+    
+    free(hosts);
+    free(indices);
+    if (export->regions) free(export->regions);
+    export->regions = copies;
+    export->num_regions = num_regions;
+    return true;
+
+FAIL:
+    if (hosts) free(hosts);
+    if (indices) free(indices);
+    if (copies) free(copies);
+    return false;
+}
+
+// copies every region into the segment (laying it out again first if the memory map changed).
+static void export_update(memory_export_t* export)
+{
+    const uint32_t generation = retro_script_memory_map_generation();
+    if (!export->header || generation != export->generation)
+    {
+        export->generation = generation;
+        if (!export_layout(export))
+        {
+            // (tried again when the memory map next changes.)
+            if (export->header) munmap(export->header, export->mapped_size);
+            export->header = NULL;
+            export->mapped_size = 0;
+            return;
+        }
+    }
+    else
+    {
+        sequence_begin(export->header);
+    }
+    
+    retro_script_export_header_t* header = export->header;
+    for (size_t k = 0; k < export->num_regions; ++k)
+    {
+        export_region_t const* region = &export->regions[k];
+        memcpy((char*)header + region->offset, region->host, region->len);
+    }
+    ++header->frame;
+    sequence_end(header);
+}
+
+static void export_free(memory_export_t* export)
+{
+    if (export->header) munmap(export->header, export->mapped_size);
+    if (export->fd >= 0)
+    {
+        close(export->fd);
+        shm_unlink(export->name);
+    }
+    if (export->regions) free(export->regions);
+    if (export->addrspace) free(export->addrspace);
+    free(export->name);
+    free(export);
+}
+
+#else
+
+static void export_free(memory_export_t* export)
+{
+    free(export->name);
+    free(export);
+}
+
+#endif
+
+void retro_script_memory_export_after_run()
+{
+    #ifdef MEMEXPORT_POSIX
+    for (memory_export_t* export = exports; export; export = export->next)
+    {
+        export_update(export);
+    }
+    #endif
+}
+
+// removes the exports matching the given name (if not NULL) and script (if nonzero).
+static size_t remove_exports(const char* name, retro_script_id_t script)
+{
+    size_t removed = 0;
+    memory_export_t** export = &exports;
+    while (*export)
+    {
+        if ((!name || !strcmp((*export)->name, name)) && (!script || (*export)->script == script))
+        {
+            memory_export_t* next = (*export)->next;
+            export_free(*export);
+            *export = next;
+            ++removed;
+        }
+        else
+        {
+            export = &(*export)->next;
+        }
+    }
+    return removed;
+}
+
+// shared memory object names must begin with a slash.
+static char* get_name(lua_State* L, int idx)
+{
+    const char* name = lua_tostring(L, idx);
+    if (name[0] == '/') return retro_script_strdup(name);
+    
+    const size_t len = strlen(name);
+    char* s = malloc_array(char, len + 2);
+    if (!s) return NULL;
+    s[0] = '/';
+    memcpy(s + 1, name, len + 1);
+    return s;
+}
+
+int retro_script_luafunc_export_memory(lua_State* L)
+{
+    // validate args
+    if (!lua_isstring(L, 1) || !lua_tostring(L, 1)[0]) return _lua_error(L, "invalid name for \"export_memory\"");
+    const char* addrspace = NULL;
+    if (lua_gettop(L) >= 2 && !lua_isnil(L, 2))
+    {
+        if (!lua_isstring(L, 2)) return _lua_error(L, "invalid addrspace for \"export_memory\"");
+        addrspace = lua_tostring(L, 2);
+    }
+    
+    script_state_t* script = script_find_lua(L);
+    if (!script) return _lua_error(L, "invalid lua context");
+    
+    #ifdef MEMEXPORT_POSIX
+    memory_export_t* export = alloc(memory_export_t);
+    if (!export) return _lua_error(L, "unable to allocate export");
+    memset(export, 0, sizeof(*export));
+    export->fd = -1;
+    export->script = script->id;
+    export->name = get_name(L, 1);
+    export->addrspace = addrspace ? retro_script_strdup(addrspace) : NULL;
+    if (!export->name || (addrspace && !export->addrspace))
+    {
+        if (export->addrspace) free(export->addrspace);
+        if (export->name) free(export->name);
+        free(export);
+        return _lua_error(L, "unable to allocate export");
+    }
+    
+    // exporting under a name the script already exports replaces it, but another script's export is left alone.
+    remove_exports(export->name, script->id);
+    for (memory_export_t const* other = exports; other; other = other->next)
+    {
+        if (!strcmp(other->name, export->name))
+        {
+            export_free(export);
+            lua_pushinteger(L, 0);
+            return 1;
+        }
+    }
+    
+    // an object which already exists (e.g. another process's) is not taken over.
+    export->fd = shm_open(export->name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    if (export->fd >= 0) export_update(export);
+    if (!export->header)
+    {
+        export_free(export);
+        lua_pushinteger(L, 0);
+        return 1;
+    }
+    
+    export->next = exports;
+    exports = export;
+    lua_pushinteger(L, export->mapped_size);
+    return 1;
+    #else
+    (void)addrspace;
+    lua_pushinteger(L, 0);
+    return 1;
+    #endif
+}
+
+int retro_script_luafunc_unexport_memory(lua_State* L)
+{
+    if (!lua_isstring(L, 1) || !lua_tostring(L, 1)[0]) return _lua_error(L, "invalid name for \"unexport_memory\"");
+    script_state_t* script = script_find_lua(L);
+    if (!script) return _lua_error(L, "invalid lua context");
+    
+    char* name = get_name(L, 1);
+    if (!name) return _lua_error(L, "unable to allocate name");
+    const size_t removed = remove_exports(name, script->id);
+    free(name);
+    
+    lua_pushinteger(L, removed ? 1 : 0);
+    return 1;
+}
+
+void retro_script_free_exports(script_state_t* script)
+{
+    if (!script) return;
+    remove_exports(NULL, script->id);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+/* mirrors emulated memory into POSIX shared memory once per frame, so that other processes can read it
+ * without going through lua.
+ *
+ * a segment begins with a header, followed by a table of regions (one per exported descriptor of the memory map),
+ * followed by the data of each region. All fields are in host byte order.
+ * the segment is guarded by a sequence lock: a reader should read the sequence number (retrying while it is odd),
+ * copy what it needs, and then read the sequence number again, retrying if it changed.
+ * the segment may grow when the memory map changes, so readers should remap it if header.size exceeds the size mapped.
+ */
+
+#include "script.h"
+
+#include <stdint.h>
+
+#define RETRO_SCRIPT_EXPORT_MAGIC 0x4d485352 // "RSHM"
+#define RETRO_SCRIPT_EXPORT_VERSION 1
+
+typedef struct retro_script_export_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;
+    uint32_t num_regions;
+    uint64_t size; // of the whole segment, in bytes.
+    uint64_t frame; // number of frames exported so far.
+} retro_script_export_header_t;
+
+typedef struct retro_script_export_region
+{
+    // as in the region's retro_memory_descriptor; the data is the descriptor's len bytes of host memory.
+    uint64_t start;
+    uint64_t select;
+    uint64_t disconnect;
+    uint64_t len;
+    
+    // of the region's data, from the start of the segment.
+    uint64_t offset;
+    
+    // nul-terminated (and truncated if necessary).
+    char addrspace[24];
+} retro_script_export_region_t;
+
+// copies exported memory into its segments. Called after the core runs a frame.
+void retro_script_memory_export_after_run();
+
+// lua args: name, [addrspace]
+//      ret: size of the segment in bytes, or 0 if it could not be created
+int retro_script_luafunc_export_memory(struct lua_State* L);
+
+// lua args: name
+//      ret: 1 if a segment was removed, 0 otherwise
+int retro_script_luafunc_unexport_memory(struct lua_State* L);
+
+// removes all segments exported by the given script.
+void retro_script_free_exports(script_state_t*);
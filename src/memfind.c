@@ -0,0 +1,338 @@
+#include "l.h"
+#include "memfind.h"
+#include "memmap.h"
+#include "util.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define MEMFIND_SSE2
+    #include <emmintrin.h>
+#endif
+
+// a byte pattern, e.g. "A9 ?? 8D".
+typedef struct find_pattern
+{
+    size_t len;
+    uint8_t* bytes; // (zero where wildcard.)
+    uint8_t* mask; // 0xff, or zero where wildcard.
+    
+    // two fixed bytes used to quickly rule out positions before comparing the whole pattern.
+    size_t anchor_first;
+    size_t anchor_second;
+} find_pattern_t;
+
+typedef struct find_match
+{
+    size_t address;
+    const uint8_t* host; // (where the match starts, so that mirrors of it can be dropped.)
+} find_match_t;
+
+typedef struct find_output
+{
+    find_match_t* matches;
+    size_t count;
+    size_t capacity;
+} find_output_t;
+
+static int _lua_error(lua_State* L, const char* message)
+{
+    return luaL_error(L, "%s", message);
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static void free_pattern(find_pattern_t* pattern)
+{
+    if (pattern->bytes) free(pattern->bytes);
+    if (pattern->mask) free(pattern->mask);
+}
+
+// pattern is a sequence of hex bytes or wildcards ("?" or "??"), optionally separated by whitespace.
+// returns false if invalid, or if the pattern has no fixed bytes.
+static bool parse_pattern(const char* s, find_pattern_t* pattern)
+{
+    memset(pattern, 0, sizeof(*pattern));
+    
+    // (each byte takes at least one character.)
+    const size_t capacity = strlen(s);
+    pattern->bytes = malloc_array(uint8_t, capacity ? capacity : 1);
+    pattern->mask = malloc_array(uint8_t, capacity ? capacity : 1);
+    if (!pattern->bytes || !pattern->mask) goto FAIL;
+    
+    while (*s)
+    {
+        if (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')
+        {
+            ++s;
+            continue;
+        }
+        
+        if (*s == '?')
+        {
+            s += (s[1] == '?') ? 2 : 1;
+            pattern->bytes[pattern->len] = 0;
+            pattern->mask[pattern->len++] = 0;
+            continue;
+        }
+        
+        const int hi = hex_digit(s[0]);
+        const int lo = (hi >= 0) ? hex_digit(s[1]) : -1;
+        if (lo < 0) goto FAIL;
+        s += 2;
+        pattern->bytes[pattern->len] = (uint8_t)(hi << 4 | lo);
+        pattern->mask[pattern->len++] = 0xff;
+    }
+    
+    // the first anchor is the first fixed byte other than 0x00 and 0xff (the most common bytes in memory),
+    // if there is one.
+    size_t first_fixed = pattern->len;
+    size_t last_fixed = 0;
+    pattern->anchor_first = pattern->len;
+    for (size_t i = 0; i < pattern->len; ++i)
+    {
+        if (!pattern->mask[i]) continue;
+        if (first_fixed == pattern->len) first_fixed = i;
+        last_fixed = i;
+        if (pattern->anchor_first == pattern->len && pattern->bytes[i] != 0x00 && pattern->bytes[i] != 0xff)
+        {
+            pattern->anchor_first = i;
+        }
+    }
+    if (first_fixed == pattern->len) goto FAIL;
+    if (pattern->anchor_first == pattern->len) pattern->anchor_first = first_fixed;
+    
+    // the second anchor is whichever of the first and last fixed bytes is further from the first anchor.
+    pattern->anchor_second = (last_fixed - pattern->anchor_first >= pattern->anchor_first - first_fixed) ? last_fixed : first_fixed;
+    
+    return true;
+
+FAIL:
+    free_pattern(pattern);
+    return false;
+}
+
+// returns false if out of memory.
+static bool find_output_add(find_output_t* out, size_t address, const uint8_t* host)
+{
+    if (out->count >= out->capacity)
+    {
+        const size_t capacity = out->capacity ? 2 * out->capacity : 64;
+        find_match_t* resized = (find_match_t*)realloc(out->matches, sizeof(find_match_t) * capacity);
+        if (!resized) return false;
+        out->matches = resized;
+        out->capacity = capacity;
+    }
+    
+    out->matches[out->count].address = address;
+    out->matches[out->count].host = host;
+    ++out->count;
+    return true;
+}
+
+static int compare_addresses(const void* a, const void* b)
+{
+    const size_t x = ((const find_match_t*)a)->address;
+    const size_t y = ((const find_match_t*)b)->address;
+    return (x > y) - (x < y);
+}
+
+// orders by host, then address.
+static int compare_hosts(const void* a, const void* b)
+{
+    find_match_t const* x = (const find_match_t*)a;
+    find_match_t const* y = (const find_match_t*)b;
+    if (x->host != y->host) return (x->host > y->host) - (x->host < y->host);
+    return compare_addresses(a, b);
+}
+
+static FORCEINLINE bool pattern_matches(find_pattern_t const* pattern, const uint8_t* data)
+{
+    for (size_t i = 0; i < pattern->len; ++i)
+    {
+        if ((data[i] & pattern->mask[i]) != pattern->bytes[i]) return false;
+    }
+    return true;
+}
+
+// checks for a match at the given address (whose first byte is at host) which continues past
+// the addresses the same descriptor maps contiguously, so must be read from emulated memory.
+static bool find_across(find_output_t* out, find_pattern_t const* pattern, size_t address, const uint8_t* host, size_t end)
+{
+    if (end - address < pattern->len) return true;
+    
+    uint8_t buff[256];
+    uint8_t* data = (pattern->len <= sizeof(buff)) ? buff : malloc_array(uint8_t, pattern->len);
+    if (!data) return false;
+    
+    bool result = true;
+    if (retro_script_memory_read_bytes(address, data, pattern->len) && pattern_matches(pattern, data))
+    {
+        result = find_output_add(out, address, host);
+    }
+    
+    if (data != buff) free(data);
+    return result;
+}
+
+// searches positions [0, positions) of data, which is mapped contiguously from the given address.
+// data must be readable up to positions + pattern->len - 1.
+static bool find_in_region(find_output_t* out, find_pattern_t const* pattern, size_t address, const uint8_t* data, size_t positions)
+{
+    const size_t k1 = pattern->anchor_first;
+    const size_t k2 = pattern->anchor_second;
+    const uint8_t b1 = pattern->bytes[k1];
+    const uint8_t b2 = pattern->bytes[k2];
+    size_t i = 0;
+    
+    #ifdef MEMFIND_SSE2
+    // compare both anchors at 16 positions at once.
+    const __m128i first = _mm_set1_epi8((char)b1);
+    const __m128i second = _mm_set1_epi8((char)b2);
+    for (; i + 16 <= positions; i += 16)
+    {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(data + i + k1));
+        const __m128i y = _mm_loadu_si128((const __m128i*)(data + i + k2));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(x, first), _mm_cmpeq_epi8(y, second)));
+        while (mask)
+        {
+            const size_t j = i + retro_script_ctz64(mask);
+            if (pattern_matches(pattern, data + j) && !find_output_add(out, address + j, data + j)) return false;
+            mask &= mask - 1;
+        }
+    }
+    #else
+    // skip to the first anchor with memchr.
+    while (i < positions)
+    {
+        const uint8_t* p = (const uint8_t*)memchr(data + i + k1, b1, positions - i);
+        if (!p) return true;
+        i = (size_t)(p - data) - k1;
+        if (data[i + k2] == b2 && pattern_matches(pattern, data + i) && !find_output_add(out, address + i, data + i)) return false;
+        ++i;
+    }
+    #endif
+    
+    for (; i < positions; ++i)
+    {
+        if (data[i + k1] == b1 && data[i + k2] == b2 && pattern_matches(pattern, data + i))
+        {
+            if (!find_output_add(out, address + i, data + i)) return false;
+        }
+    }
+    
+    return true;
+}
+
+// searches every run of the descriptor which is reachable from [start, end).
+static bool find_in_descriptor(find_output_t* out, find_pattern_t const* pattern, struct retro_memory_descriptor const* descriptor, size_t start, size_t end)
+{
+    size_t run;
+    for (size_t offset = 0; offset < descriptor->len; offset += run)
+    {
+        size_t address;
+        if (!retro_script_memory_descriptor_locate_in(NULL, descriptor, offset, &address, &run)) continue;
+        
+        // clip to [start, end).
+        size_t lo = 0;
+        size_t hi = run;
+        if (address < start) lo = (start - address < hi) ? start - address : hi;
+        if (end <= address) hi = 0;
+        else if (end - address < hi) hi = end - address;
+        if (hi <= lo) continue;
+        
+        const uint8_t* host = (const uint8_t*)descriptor->ptr + descriptor->offset + offset;
+        if (hi - lo >= pattern->len)
+        {
+            if (!find_in_region(out, pattern, address + lo, host + lo, hi - lo - pattern->len + 1)) return false;
+        }
+        
+        // matches which continue past the run.
+        const size_t across = (hi - lo >= pattern->len) ? hi - pattern->len + 1 : lo;
+        for (size_t k = across; k < hi; ++k)
+        {
+            if (!find_across(out, pattern, address + k, host + k, end)) return false;
+        }
+    }
+    
+    return true;
+}
+
+int retro_script_luafunc_memory_find(lua_State* L)
+{
+    // validate args
+    if (!lua_isstring(L, 1)) return _lua_error(L, "invalid pattern for \"find\"");
+    size_t start = 0;
+    size_t end = SIZE_MAX;
+    size_t max = SIZE_MAX;
+    if (lua_gettop(L) >= 2 && !lua_isnil(L, 2))
+    {
+        if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) < 0) return _lua_error(L, "invalid start address for \"find\"");
+        start = lua_tointeger(L, 2);
+    }
+    if (lua_gettop(L) >= 3 && !lua_isnil(L, 3))
+    {
+        if (!lua_isinteger(L, 3) || lua_tointeger(L, 3) < 0) return _lua_error(L, "invalid end address for \"find\"");
+        end = lua_tointeger(L, 3);
+    }
+    if (lua_gettop(L) >= 4 && !lua_isnil(L, 4))
+    {
+        if (!lua_isinteger(L, 4) || lua_tointeger(L, 4) < 0) return _lua_error(L, "invalid maximum for \"find\"");
+        max = lua_tointeger(L, 4);
+    }
+    
+    find_pattern_t pattern;
+    if (!parse_pattern(lua_tostring(L, 1), &pattern)) return _lua_error(L, "invalid pattern for \"find\"");
+    
+    find_output_t out;
+    memset(&out, 0, sizeof(out));
+    
+    size_t num_descriptors;
+    struct retro_memory_descriptor const* descriptors = retro_script_memory_get_descriptors(&num_descriptors);
+    
+    // every match is collected before max applies, since descriptors are not in address order.
+    bool ok = true;
+    for (size_t i = 0; i < num_descriptors && ok; ++i)
+    {
+        struct retro_memory_descriptor const* descriptor = &descriptors[i];
+        if (!descriptor->ptr || descriptor->len == 0) continue;
+        ok = find_in_descriptor(&out, &pattern, descriptor, start, end);
+    }
+    
+    free_pattern(&pattern);
+    if (!ok)
+    {
+        if (out.matches) free(out.matches);
+        return _lua_error(L, "unable to allocate memory for \"find\"");
+    }
+    
+    // memory mirrored by several descriptors is only reported at its lowest address.
+    if (out.count)
+    {
+        qsort(out.matches, out.count, sizeof(find_match_t), compare_hosts);
+        size_t kept = 1;
+        for (size_t i = 1; i < out.count; ++i)
+        {
+            if (out.matches[i].host != out.matches[kept - 1].host) out.matches[kept++] = out.matches[i];
+        }
+        out.count = kept;
+        qsort(out.matches, out.count, sizeof(find_match_t), compare_addresses);
+    }
+    if (out.count > max) out.count = max;
+    
+    lua_createtable(L, out.count, 0);
+    for (size_t i = 0; i < out.count; ++i)
+    {
+        lua_pushinteger(L, out.matches[i].address);
+        lua_rawseti(L, -2, i + 1);
+    }
+    if (out.matches) free(out.matches);
+    return 1;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+struct lua_State;
+
+// lua args: pattern, [start], [end], [max]
+//      ret: array of addresses at which the pattern was found
+int retro_script_luafunc_memory_find(struct lua_State* L);
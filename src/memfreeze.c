@@ -0,0 +1,182 @@
+#include "l.h"
+#include "memfreeze.h"
+#include "memmap.h"
+#include "memjournal.h"
+#include "memtype.h"
+#include "script_list.h"
+#include "util.h"
+
+#include <stdint.h>
+
+typedef struct memory_freeze
+{
+    size_t address;
+    retro_script_id_t script;
+    uint8_t size;
+    
+    // in memory byte order.
+    uint8_t data[8];
+    
+    // NULL if the value does not lie contiguously in writable host memory;
+    // it is then written through the memory map.
+    char* host;
+} memory_freeze_t;
+
+// sorted by address and then script, with at most one freeze per address per script.
+// (where several scripts freeze the same address, the freeze of the script loaded last is applied last, so it prevails.)
+static memory_freeze_t* freezes = NULL;
+static size_t num_freezes = 0;
+static size_t freezes_capacity = 0;
+
+// memory map generation the host pointers were resolved for.
+static uint32_t freezes_generation = 0;
+
+static int _lua_error(lua_State* L, const char* message)
+{
+    return luaL_error(L, "%s", message);
+}
+
+static void freeze_resolve(memory_freeze_t* freeze)
+{
+    bool is_const = false;
+    freeze->host = retro_script_memory_access_range(freeze->address, freeze->size, &is_const);
+    if (is_const) freeze->host = NULL;
+}
+
+// index of the first freeze at or after the given address and script.
+static size_t freeze_lower_bound(size_t address, retro_script_id_t script)
+{
+    size_t lo = 0, hi = num_freezes;
+    while (lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (freezes[mid].address < address || (freezes[mid].address == address && freezes[mid].script < script))
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void retro_script_memory_freeze_apply()
+{
+    if (num_freezes == 0) return;
+    
+    const uint32_t generation = retro_script_memory_map_generation();
+    if (generation != freezes_generation)
+    {
+        for (size_t i = 0; i < num_freezes; ++i)
+        {
+            freeze_resolve(&freezes[i]);
+        }
+        freezes_generation = generation;
+    }
+    
+    for (size_t i = 0; i < num_freezes; ++i)
+    {
+        memory_freeze_t const* freeze = &freezes[i];
+        if (freeze->host)
+        {
+            memcpy(freeze->host, freeze->data, freeze->size);
+        }
+        else
+        {
+            retro_script_memory_write_bytes(freeze->address, freeze->data, freeze->size);
+        }
+    }
+}
+
+int retro_script_luafunc_memory_freeze(lua_State* L)
+{
+    // validate args
+    retro_script_memtype_t type;
+    if (!lua_isinteger(L, 1) || lua_tointeger(L, 1) < 0) return _lua_error(L, "invalid address for \"freeze\"");
+    if (!retro_script_memtype_parse_lua(L, 2, 4, &type)) return _lua_error(L, "invalid type for \"freeze\"");
+    
+    memory_freeze_t freeze;
+    memset(&freeze, 0, sizeof(freeze));
+    freeze.address = lua_tointeger(L, 1);
+    freeze.size = type.size;
+    if (!retro_script_memtype_to(L, 3, type, freeze.data)) return _lua_error(L, "invalid value for \"freeze\"");
+    retro_script_memtype_swap(type, freeze.data, 1);
+    
+    script_state_t* script = script_find_lua(L);
+    if (!script) return _lua_error(L, "invalid lua context");
+    freeze.script = script->id;
+    
+    // the value is written immediately, which also checks that the memory is writable.
+    if (!retro_script_journal_write_now_in(NULL, freeze.address, freeze.data, freeze.size))
+    {
+        lua_pushinteger(L, 0);
+        return 1;
+    }
+    
+    freeze_resolve(&freeze);
+    
+    // replace this script's existing freeze at this address, or insert in order.
+    const size_t i = freeze_lower_bound(freeze.address, freeze.script);
+    if (i >= num_freezes || freezes[i].address != freeze.address || freezes[i].script != freeze.script)
+    {
+        if (num_freezes >= freezes_capacity)
+        {
+            const size_t capacity = freezes_capacity ? 2 * freezes_capacity : 16;
+            memory_freeze_t* resized = (memory_freeze_t*)realloc(freezes, sizeof(memory_freeze_t) * capacity);
+            if (!resized) return _lua_error(L, "unable to allocate freeze");
+            freezes = resized;
+            freezes_capacity = capacity;
+        }
+        
+        memmove(&freezes[i + 1], &freezes[i], sizeof(memory_freeze_t) * (num_freezes - i));
+        ++num_freezes;
+    }
+    freezes[i] = freeze;
+    
+    lua_pushinteger(L, 1);
+    return 1;
+}
+
+// removes the freezes matching the given address (if has_address) and script (if nonzero).
+static size_t remove_freezes(bool has_address, size_t address, retro_script_id_t script)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < num_freezes; ++i)
+    {
+        const bool matches = (!has_address || freezes[i].address == address) && (!script || freezes[i].script == script);
+        if (!matches)
+        {
+            freezes[kept++] = freezes[i];
+        }
+    }
+    
+    const size_t removed = num_freezes - kept;
+    num_freezes = kept;
+    if (num_freezes == 0 && freezes)
+    {
+        free(freezes);
+        freezes = NULL;
+        freezes_capacity = 0;
+    }
+    return removed;
+}
+
+int retro_script_luafunc_memory_unfreeze(lua_State* L)
+{
+    const bool has_address = lua_gettop(L) >= 1 && !lua_isnil(L, 1);
+    if (has_address && (!lua_isinteger(L, 1) || lua_tointeger(L, 1) < 0)) return _lua_error(L, "invalid address for \"unfreeze\"");
+    
+    // only this script's freezes (at the address, or all of them if there is none) are removed.
+    script_state_t* script = script_find_lua(L);
+    if (!script) return _lua_error(L, "invalid lua context");
+    lua_pushinteger(L, remove_freezes(has_address, has_address ? lua_tointeger(L, 1) : 0, script->id));
+    return 1;
+}
+
+void retro_script_free_freezes(script_state_t* script)
+{
+    if (!script) return;
+    remove_freezes(false, 0, script->id);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+/* values held fixed in emulated memory, rewritten around every frame without calling into lua.
+ */
+
+#include "script.h"
+
+// writes every frozen value. Called immediately before and after the core runs a frame.
+void retro_script_memory_freeze_apply();
+
+// lua args: address, type, value, [endian]
+//      ret: 1 if frozen, 0 if the memory is not writable
+int retro_script_luafunc_memory_freeze(struct lua_State* L);
+
+// lua args: [address]
+//      ret: number of values unfrozen
+int retro_script_luafunc_memory_unfreeze(struct lua_State* L);
+
+// unfreezes all values frozen by the given script.
+void retro_script_free_freezes(script_state_t*);
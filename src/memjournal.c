@@ -0,0 +1,314 @@
+#include "l.h"
+#include "memjournal.h"
+#include "memmap.h"
+#include "script_list.h"
+#include "util.h"
+
+#include <stdint.h>
+
+typedef struct journal_entry
+{
+    // NULL once the write has been discarded (see retro_script_journal_forget).
+    char* host;
+    
+    // the latest address written through (addrspace is interned by the memory map).
+    const char* addrspace;
+    size_t address;
+    
+    uint8_t value;
+} journal_entry_t;
+
+bool retro_script_journal_active = false;
+bool retro_script_journal_pending = false;
+
+// entries in the order first written (and in host address order once applied).
+static journal_entry_t* entries = NULL;
+static size_t num_entries = 0;
+static size_t entries_capacity = 0;
+
+// open-addressed hash table of entry index + 1 (zero if empty), keyed by host pointer.
+static uint32_t* slots = NULL;
+static size_t slots_capacity = 0;
+
+// host range covered by the entries, to quickly skip reads elsewhere.
+static const char* host_min = NULL;
+static const char* host_max = NULL;
+
+// memory map generation the host pointers were resolved for.
+static uint32_t journal_generation = 0;
+
+static int _lua_error(lua_State* L, const char* message)
+{
+    return luaL_error(L, "%s", message);
+}
+
+static FORCEINLINE size_t slot_hash(const char* host)
+{
+    return (size_t)(((uint64_t)(uintptr_t)host * 0x9E3779B97F4A7C15ull) >> 32) & (slots_capacity - 1);
+}
+
+// returns the slot holding the entry for host, or the empty slot where it belongs.
+static FORCEINLINE uint32_t* find_slot(const char* host)
+{
+    size_t i = slot_hash(host);
+    while (slots[i] && entries[slots[i] - 1].host != host)
+    {
+        i = (i + 1) & (slots_capacity - 1);
+    }
+    return &slots[i];
+}
+
+// grows the slots to at least the given capacity.
+static bool grow_slots(size_t min_capacity)
+{
+    size_t capacity = slots_capacity ? 2 * slots_capacity : 256;
+    while (capacity < min_capacity) capacity *= 2;
+    uint32_t* resized = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+    if (!resized) return false;
+    
+    if (slots) free(slots);
+    slots = resized;
+    slots_capacity = capacity;
+    
+    for (size_t i = 0; i < num_entries; ++i)
+    {
+        if (entries[i].host) *find_slot(entries[i].host) = (uint32_t)(i + 1);
+    }
+    return true;
+}
+
+void retro_script_journal_begin()
+{
+    if (num_entries && slots) memset(slots, 0, sizeof(uint32_t) * slots_capacity);
+    num_entries = 0;
+    host_min = NULL;
+    host_max = NULL;
+    retro_script_journal_pending = false;
+}
+
+// makes room for count more entries, so that recording them cannot fail part way.
+static bool journal_reserve(size_t count)
+{
+    // (slots hold entry index + 1, and stay at most half full.)
+    const size_t needed = num_entries + count;
+    if (needed < num_entries || needed >= UINT32_MAX || needed > SIZE_MAX / 4) return false;
+    
+    if (needed > entries_capacity)
+    {
+        size_t capacity = entries_capacity ? 2 * entries_capacity : 128;
+        while (capacity < needed) capacity *= 2;
+        if (capacity > SIZE_MAX / sizeof(journal_entry_t)) return false;
+        journal_entry_t* resized = (journal_entry_t*)realloc(entries, sizeof(journal_entry_t) * capacity);
+        if (!resized) return false;
+        entries = resized;
+        entries_capacity = capacity;
+    }
+    
+    if (2 * needed > slots_capacity && !grow_slots(2 * needed)) return false;
+    return true;
+}
+
+// records count bytes written to the given host memory, which the given address maps to.
+// room for them must have been reserved.
+static void journal_record(char* host, const char* addrspace, size_t emulated_address, const void* in, size_t count)
+{
+    if (num_entries == 0) journal_generation = retro_script_memory_map_generation();
+    
+    for (size_t k = 0; k < count; ++k)
+    {
+        uint32_t* slot = find_slot(host + k);
+        if (!*slot)
+        {
+            entries[num_entries].host = host + k;
+            *slot = (uint32_t)++num_entries;
+            
+            if (!host_min || host + k < host_min) host_min = host + k;
+            if (!host_max || host + k > host_max) host_max = host + k;
+        }
+        
+        journal_entry_t* entry = &entries[*slot - 1];
+        entry->addrspace = addrspace;
+        entry->address = emulated_address + k;
+        entry->value = ((const uint8_t*)in)[k];
+    }
+    
+    retro_script_journal_pending = true;
+}
+
+// replaces bytes just read from the given host memory with any recorded writes to them.
+static void journal_overlay(const char* host, void* out, size_t count)
+{
+    if (num_entries == 0 || host > host_max || host + count <= host_min) return;
+    
+    for (size_t k = 0; k < count; ++k)
+    {
+        const uint32_t slot = *find_slot(host + k);
+        if (slot) ((uint8_t*)out)[k] = entries[slot - 1].value;
+    }
+}
+
+void retro_script_journal_forget(const char* host, size_t count)
+{
+    // (once applied, the entries are only a log, and are kept.)
+    if (!retro_script_journal_pending || host > host_max || host + count <= host_min) return;
+    
+    // (the slot is kept, so that probing past it still finds later entries.)
+    for (size_t k = 0; k < count; ++k)
+    {
+        const uint32_t slot = *find_slot(host + k);
+        if (slot) entries[slot - 1].host = NULL;
+    }
+}
+
+bool retro_script_journal_read_bytes_in(const char* addrspace, size_t emulated_address, void* out, size_t count)
+{
+    if (!retro_script_memory_read_bytes_in(addrspace, emulated_address, out, count)) return false;
+    if (!retro_script_journal_pending) return true;
+    
+    char* dst = (char*)out;
+    while (count > 0)
+    {
+        size_t span;
+        const char* host = retro_script_memory_access_span_in(addrspace, emulated_address, count, &span, NULL);
+        if (!host) break;
+        journal_overlay(host, dst, span);
+        
+        dst += span;
+        emulated_address += span;
+        count -= span;
+    }
+    return true;
+}
+
+bool retro_script_journal_write_now_in(const char* addrspace, size_t emulated_address, const void* in, size_t count)
+{
+    if (!retro_script_memory_write_bytes_in(addrspace, emulated_address, in, count)) return false;
+    if (!retro_script_journal_pending) return true;
+    
+    while (count > 0)
+    {
+        size_t span;
+        const char* host = retro_script_memory_access_span_in(addrspace, emulated_address, count, &span, NULL);
+        if (!host) break;
+        retro_script_journal_forget(host, span);
+        
+        emulated_address += span;
+        count -= span;
+    }
+    return true;
+}
+
+bool retro_script_journal_write_bytes_in(const char* addrspace, size_t emulated_address, const void* in, size_t count)
+{
+    if (!retro_script_journal_active) return retro_script_journal_write_now_in(addrspace, emulated_address, in, count);
+    
+    for (int k = 0; k <= 1; ++k) // on first pass, just check that the whole range is writeable.
+    {
+        // (so that a failure leaves the journal unchanged.)
+        if (k == 1 && !journal_reserve(count)) return false;
+        
+        const char* src = (const char*)in;
+        size_t address = emulated_address;
+        size_t remaining = count;
+        while (remaining > 0)
+        {
+            size_t span;
+            struct retro_memory_descriptor const* descriptor;
+            char* host = retro_script_memory_access_span_in(addrspace, address, remaining, &span, &descriptor);
+            if (!host || (descriptor->flags & RETRO_MEMDESC_CONST)) return false;
+            
+            if (k == 1) journal_record(host, descriptor->addrspace, address, src, span);
+            
+            src += span;
+            address += span;
+            remaining -= span;
+        }
+    }
+    return true;
+}
+
+bool retro_script_journal_read_bits_in(const char* addrspace, size_t emulated_address, size_t bit_offset, unsigned width, bool big_endian, uint64_t* out)
+{
+    if (width == 0 || width > 64) return false;
+    
+    const size_t count = retro_script_memory_bitfield_bytes(&emulated_address, &bit_offset, width);
+    uint8_t bytes[MEMORY_MAX_BITFIELD_BYTES];
+    if (!retro_script_journal_read_bytes_in(addrspace, emulated_address, bytes, count)) return false;
+    
+    *out = retro_script_memory_bitfield_get(bytes, count, bit_offset, width, big_endian);
+    return true;
+}
+
+bool retro_script_journal_write_bits_in(const char* addrspace, size_t emulated_address, size_t bit_offset, unsigned width, bool big_endian, uint64_t in)
+{
+    if (width == 0 || width > 64) return false;
+    
+    const size_t count = retro_script_memory_bitfield_bytes(&emulated_address, &bit_offset, width);
+    uint8_t bytes[MEMORY_MAX_BITFIELD_BYTES];
+    if (!retro_script_journal_read_bytes_in(addrspace, emulated_address, bytes, count)) return false;
+    
+    retro_script_memory_bitfield_set(bytes, count, bit_offset, width, big_endian, in);
+    return retro_script_journal_write_bytes_in(addrspace, emulated_address, bytes, count);
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+    const char* x = ((const journal_entry_t*)a)->host;
+    const char* y = ((const journal_entry_t*)b)->host;
+    return (x > y) - (x < y);
+}
+
+void retro_script_journal_apply()
+{
+    if (!retro_script_journal_pending) return;
+    retro_script_journal_pending = false;
+    
+    // host pointers are stale if the memory map changed since; the writes are dropped.
+    if (journal_generation != retro_script_memory_map_generation())
+    {
+        retro_script_journal_begin();
+        return;
+    }
+    
+    // (the hash table is not needed after this, and is cleared by the next begin.)
+    qsort(entries, num_entries, sizeof(journal_entry_t), compare_entries);
+    for (size_t i = 0; i < num_entries; ++i)
+    {
+        if (entries[i].host) *(uint8_t*)entries[i].host = entries[i].value;
+    }
+}
+
+int retro_script_luafunc_defer_writes(lua_State* L)
+{
+    script_state_t* script = script_find_lua(L);
+    if (!script) return _lua_error(L, "invalid lua context");
+    
+    script->defer_writes = lua_gettop(L) < 1 || lua_toboolean(L, 1);
+    return 0;
+}
+
+int retro_script_luafunc_write_log(lua_State* L)
+{
+    // (addrspaces are freed with the memory map.)
+    if (journal_generation != retro_script_memory_map_generation()) retro_script_journal_begin();
+    
+    lua_createtable(L, num_entries, 0);
+    lua_createtable(L, num_entries, 0);
+    lua_createtable(L, num_entries, 0);
+    
+    lua_Integer n = 0;
+    for (size_t i = 0; i < num_entries; ++i)
+    {
+        journal_entry_t const* entry = &entries[i];
+        if (!entry->host) continue;
+        ++n;
+        lua_pushinteger(L, entry->address);
+        lua_rawseti(L, -4, n);
+        lua_pushinteger(L, entry->value);
+        lua_rawseti(L, -3, n);
+        lua_pushstring(L, entry->addrspace ? entry->addrspace : "");
+        lua_rawseti(L, -2, n);
+    }
+    
+    return 3;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+/* deferred script writes: while active, writes made through these functions are recorded in a journal,
+ * coalesced by host address, rather than stored. The journal is applied in one pass before the core
+ * runs a frame, and is then kept as a log of that frame's writes.
+ *
+ * the journal is only used from the thread running the scripts, and only by these functions: the memory map's
+ * own accessors (memmap.h) never see it, so they stay safe to call from other threads.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct lua_State;
+
+// set while writes should be recorded rather than stored.
+extern bool retro_script_journal_active;
+
+// set while the journal holds writes which have not been applied yet; reads then see those writes.
+extern bool retro_script_journal_pending;
+
+// discards the previous frame's journal.
+void retro_script_journal_begin();
+
+// stores every recorded write, in host address order.
+void retro_script_journal_apply();
+
+// as retro_script_memory_read_bytes_in, but reads see any recorded writes.
+bool retro_script_journal_read_bytes_in(const char* addrspace, size_t emulated_address, void* out, size_t count);
+
+// as retro_script_memory_write_bytes_in, but the write is recorded while the journal is active.
+// returns false if any byte is unmapped or const (or the journal could not be extended).
+bool retro_script_journal_write_bytes_in(const char* addrspace, size_t emulated_address, const void* in, size_t count);
+
+// as retro_script_memory_write_bytes_in, storing immediately even while the journal is active.
+// (recorded writes to the same bytes are discarded, so that applying the journal does not undo this write.)
+bool retro_script_journal_write_now_in(const char* addrspace, size_t emulated_address, const void* in, size_t count);
+
+// as retro_script_memory_read_bits_in/write_bits_in, through the journal.
+bool retro_script_journal_read_bits_in(const char* addrspace, size_t emulated_address, size_t bit_offset, unsigned width, bool big_endian, uint64_t* out);
+bool retro_script_journal_write_bits_in(const char* addrspace, size_t emulated_address, size_t bit_offset, unsigned width, bool big_endian, uint64_t in);
+
+// discards pending recorded writes to count bytes of host memory, which is about to be written directly.
+void retro_script_journal_forget(const char* host, size_t count);
+
+// lua args: [enable]
+int retro_script_luafunc_defer_writes(struct lua_State* L);
+
+// lua args: (none)
+//      ret: array of addresses, array of values, array of addrspaces
+int retro_script_luafunc_write_log(struct lua_State* L);
@@ -1,15 +1,122 @@
 #include "memmap.h"
+#include "hashmap.h"
+#include "bswap.h"
 #include "util.h"
 
-#if IC_COMPILER_MSC
-#define __BYTE_ORDER__ 4321
-#define __ORDER_BIG_ENDIAN__ 4321
-#define __ORDER_LITTLE_ENDIAN__ 1234
+#include <stdint.h>
+
+// pext/pdep are used for address translation if the build targets BMI2 (-mbmi2);
+// otherwise the translation is done with precomputed shifts.
+#if defined(__BMI2__) && (defined(__x86_64__) || defined(_M_X64))
+    #define MEMMAP_BMI2
+    #include <immintrin.h>
 #endif
 
+// the memory map is indexed by a page table, so that an address can be resolved
+// to its descriptor without scanning the descriptor list.
+// pages are classified once, when the memory map is set.
+#define PAGE_BITS 10
+#define PAGE_SIZE ((size_t)1 << PAGE_BITS)
+
+// a leaf holds the entries for LEAF_SIZE consecutive pages.
+#define LEAF_BITS 10
+#define LEAF_SIZE ((size_t)1 << LEAF_BITS)
+
+// leaves for the lower 4 GiB are held in a flat directory;
+// leaves above that (sparse 64-bit address spaces) are held in a hashmap.
+#define DIRECTORY_SIZE ((size_t)1 << (32 - PAGE_BITS - LEAF_BITS))
+
+// upper bound on the number of pages classified when the map is set.
+// any other page falls back to a linear scan of the descriptors.
+#define MAX_INDEXED_PAGES ((size_t)1 << 18)
+
+// page table entry. The low two bits are the page kind, the rest is a descriptor index.
+typedef uint32_t page_entry_t;
+
+enum
+{
+    PAGE_UNKNOWN = 0, // not classified; scan all descriptors.
+    PAGE_NONE = 1, // no descriptor maps any address on this page.
+    PAGE_FULL = 2, // the indexed descriptor maps every address on this page.
+    PAGE_PARTIAL = 3, // scan descriptors, starting at the indexed one.
+};
+
+#define PAGE_ENTRY(kind, index) ((page_entry_t)(kind) | ((page_entry_t)(index) << 2))
+#define PAGE_KIND(entry) ((entry) & 3)
+#define PAGE_INDEX(entry) ((entry) >> 2)
+
+typedef struct memory_index
+{
+    // descriptors covered by this index, in memory map order.
+    struct retro_memory_descriptor** descriptors;
+    size_t num_descriptors;
+    
+    page_entry_t** directory;
+    struct retro_script_hashmap* upper_leaves;
+    
+    // every allocated leaf, so that they can be freed.
+    page_entry_t** leaves;
+    size_t num_leaves;
+} memory_index_t;
+
+// a descriptor's select, disconnect and len, compiled so that an address can be translated to an
+// offset into the descriptor with a few masks and shifts.
+#define MAX_TRANSLATION_SEGMENTS 4
+
+typedef struct descriptor_translation
+{
+    // descriptors which do not follow the rules in libretro.h (e.g. zero select, but len not a power of two)
+    // map [start, start + len) linearly instead, with disconnected bits cleared.
+    bool linear;
+    
+    // an address is claimed if (address ^ start) & select is zero.
+    // (this also includes every bit above the highest address in the memory map.)
+    size_t select;
+    
+    // the offset is the bits of (address & ~select) picked out by extract, packed together,
+    // with len then applied.
+    size_t extract;
+    bool len_is_pow2;
+    
+    // extract split into runs of consecutive bits, so the offset is the sum of (address & mask) >> shift.
+    // zero if there are too many runs.
+    size_t num_segments;
+    size_t segment_mask[MAX_TRANSLATION_SEGMENTS];
+    unsigned segment_shift[MAX_TRANSLATION_SEGMENTS];
+    
+    // consecutive addresses map to consecutive offsets within aligned blocks of this size (zero: unlimited).
+    size_t block;
+} descriptor_translation_t;
+
 static char** addrspaces;
 static struct retro_memory_map memmap;
 
+// one per descriptor of memmap.
+static descriptor_translation_t* translations;
+
+// indexes every descriptor, regardless of addrspace.
+static memory_index_t memmap_index;
+
+// one index per entry of addrspaces, covering only that addrspace's descriptors.
+static memory_index_t* addrspace_indices;
+static size_t num_addrspaces;
+
+// incremented whenever the memory map changes.
+static uint32_t memmap_generation = 0;
+
+static void free_index(memory_index_t* index)
+{
+    for (size_t i = 0; i < index->num_leaves; ++i)
+    {
+        free(index->leaves[i]);
+    }
+    if (index->leaves) free(index->leaves);
+    if (index->directory) free(index->directory);
+    if (index->upper_leaves) retro_script_hashmap_destroy(index->upper_leaves);
+    if (index->descriptors) free(index->descriptors);
+    memset(index, 0, sizeof(*index));
+}
+
 static void free_memmap()
 {
     if (addrspaces)
@@ -20,11 +127,520 @@ static void free_memmap()
         }
         
         free(addrspaces);
+        addrspaces = NULL;
     }
     if (memmap.num_descriptors)
     {
         free((void*)memmap.descriptors);
     }
+    memset(&memmap, 0, sizeof(memmap));
+    if (translations)
+    {
+        free(translations);
+        translations = NULL;
+    }
+    free_index(&memmap_index);
+    if (addrspace_indices)
+    {
+        for (size_t i = 0; i < num_addrspaces; ++i)
+        {
+            free_index(&addrspace_indices[i]);
+        }
+        free(addrspace_indices);
+        addrspace_indices = NULL;
+    }
+    num_addrspaces = 0;
+    ++memmap_generation;
+}
+
+static FORCEINLINE size_t lowest_bit(size_t n)
+{
+    return n & (~n + 1);
+}
+
+// sets every bit below the highest set bit.
+static size_t add_bits_down(size_t n)
+{
+    n |= n >> 1;
+    n |= n >> 2;
+    n |= n >> 4;
+    n |= n >> 8;
+    n |= n >> 16;
+    #if SIZE_MAX > UINT32_MAX
+    n |= n >> 32;
+    #endif
+    return n;
+}
+
+static FORCEINLINE size_t highest_bit(size_t n)
+{
+    n = add_bits_down(n);
+    return n ^ (n >> 1);
+}
+
+// packs together the bits of value selected by mask (pext).
+static size_t extract_bits(size_t value, size_t mask)
+{
+    size_t out = 0;
+    for (size_t bit = 1; mask; bit <<= 1, mask &= mask - 1)
+    {
+        if (value & lowest_bit(mask)) out |= bit;
+    }
+    return out;
+}
+
+// spreads the low bits of value out over the bits of mask (pdep).
+static size_t deposit_bits(size_t value, size_t mask)
+{
+    size_t out = 0;
+    for (size_t bit = 1; mask; bit <<= 1, mask &= mask - 1)
+    {
+        if (value & bit) out |= lowest_bit(mask);
+    }
+    return out;
+}
+
+static FORCEINLINE descriptor_translation_t const* get_translation(struct retro_memory_descriptor const* descriptor)
+{
+    return &translations[descriptor - memmap.descriptors];
+}
+
+// the packed bits of the address, before len is applied.
+static FORCEINLINE size_t translation_extract(descriptor_translation_t const* translation, size_t emulated_address)
+{
+    #ifdef MEMMAP_BMI2
+    return (size_t)_pext_u64(emulated_address & ~translation->select, translation->extract);
+    #else
+    if (translation->num_segments)
+    {
+        size_t raw = 0;
+        for (size_t i = 0; i < translation->num_segments; ++i)
+        {
+            raw |= (emulated_address & translation->segment_mask[i]) >> translation->segment_shift[i];
+        }
+        return raw;
+    }
+    return extract_bits(emulated_address & ~translation->select, translation->extract);
+    #endif
+}
+
+// "if the address is higher than len, the highest bit of the address is cleared", repeatedly.
+static FORCEINLINE size_t translation_apply_len(struct retro_memory_descriptor const* descriptor, descriptor_translation_t const* translation, size_t raw)
+{
+    if (!translation->len_is_pow2)
+    {
+        while (raw >= descriptor->len)
+        {
+            raw ^= highest_bit(raw);
+        }
+    }
+    return raw;
+}
+
+// the offset of a claimed address.
+static FORCEINLINE size_t translation_offset(struct retro_memory_descriptor const* descriptor, descriptor_translation_t const* translation, size_t emulated_address)
+{
+    if (translation->linear) return (emulated_address & ~descriptor->disconnect) - descriptor->start;
+    return translation_apply_len(descriptor, translation, translation_extract(translation, emulated_address));
+}
+
+// compiles the translation for the descriptor, and fills in its select and len if the core left them zero.
+// top is every bit which any address in the memory map can use.
+static void compile_translation(struct retro_memory_descriptor* descriptor, descriptor_translation_t* translation, size_t top)
+{
+    memset(translation, 0, sizeof(*translation));
+    translation->linear = true;
+    
+    size_t select = descriptor->select;
+    if (select == 0)
+    {
+        // each byte is mapped exactly once; len must be a power of two.
+        if (descriptor->len == 0 || (descriptor->len & (descriptor->len - 1))) return;
+        select = top & ~deposit_bits(descriptor->len - 1, ~descriptor->disconnect);
+    }
+    
+    // a bit which is set in start must also be set in select.
+    if (descriptor->start & ~select & top) return;
+    
+    size_t len = descriptor->len;
+    if (len == 0)
+    {
+        // as large as select and disconnect allow.
+        len = add_bits_down(extract_bits(top & ~select, ~descriptor->disconnect)) + 1;
+        if (len == 0) return;
+    }
+    
+    descriptor->select = select & top;
+    descriptor->len = len;
+    
+    translation->linear = false;
+    translation->select = select | ~top;
+    translation->len_is_pow2 = !(len & (len - 1));
+    
+    // the offset has as many bits as len needs; they are taken from the connected bits, lowest first.
+    translation->extract = deposit_bits(add_bits_down(len - 1), ~descriptor->disconnect);
+    
+    // split extract into runs of consecutive bits.
+    size_t remaining = translation->extract;
+    size_t consumed = 0;
+    while (remaining)
+    {
+        const size_t low = lowest_bit(remaining);
+        const size_t run = remaining & ~(remaining + low);
+        if (translation->num_segments < MAX_TRANSLATION_SEGMENTS)
+        {
+            translation->segment_mask[translation->num_segments] = run & ~translation->select;
+            translation->segment_shift[translation->num_segments] = retro_script_ctz64(low) - consumed;
+        }
+        ++translation->num_segments;
+        consumed += retro_script_popcount64(run);
+        remaining &= ~run;
+    }
+    if (translation->num_segments > MAX_TRANSLATION_SEGMENTS) translation->num_segments = 0;
+    
+    translation->block = lowest_bit(~(translation->extract & ~translation->select));
+}
+
+static FORCEINLINE bool descriptor_contains(struct retro_memory_descriptor const* descriptor, size_t emulated_address, size_t* offset)
+{
+    descriptor_translation_t const* translation = get_translation(descriptor);
+    if (translation->linear)
+    {
+        size_t addr = emulated_address & ~descriptor->disconnect;
+        if (addr < descriptor->start) return false;
+        addr -= descriptor->start;
+        if (addr >= descriptor->len) return false;
+        *offset = addr;
+        return true;
+    }
+    
+    if ((emulated_address ^ descriptor->start) & translation->select) return false;
+    *offset = translation_offset(descriptor, translation, emulated_address);
+    return true;
+}
+
+// returns PAGE_NONE, PAGE_FULL, or PAGE_PARTIAL, depending on how much of the
+// page starting at the given address is mapped by the given descriptor.
+static int classify_page(struct retro_memory_descriptor const* descriptor, size_t page_address)
+{
+    descriptor_translation_t const* translation = get_translation(descriptor);
+    if (!translation->linear)
+    {
+        if ((page_address ^ descriptor->start) & translation->select & ~(PAGE_SIZE - 1)) return PAGE_NONE;
+        
+        // only some of the page is claimed, or it is claimed but not contiguously.
+        if (translation->select & (PAGE_SIZE - 1)) return PAGE_PARTIAL;
+        if (translation->block && translation->block < PAGE_SIZE) return PAGE_PARTIAL;
+        
+        // len may fold the page partway through.
+        if (descriptor->len % PAGE_SIZE != 0 && translation_offset(descriptor, translation, page_address) + PAGE_SIZE > descriptor->len)
+        {
+            return PAGE_PARTIAL;
+        }
+        
+        return PAGE_FULL;
+    }
+    
+    if (descriptor->len == 0) return PAGE_NONE;
+    
+    // disconnected bits within the page mean the page does not map contiguously.
+    if (descriptor->disconnect & (PAGE_SIZE - 1)) return PAGE_PARTIAL;
+    
+    size_t addr = page_address & ~descriptor->disconnect;
+    if (addr < descriptor->start)
+    {
+        return (descriptor->start - addr >= PAGE_SIZE) ? PAGE_NONE : PAGE_PARTIAL;
+    }
+    
+    addr -= descriptor->start;
+    if (addr >= descriptor->len) return PAGE_NONE;
+    return (descriptor->len - addr >= PAGE_SIZE) ? PAGE_FULL : PAGE_PARTIAL;
+}
+
+static page_entry_t classify_page_entry(memory_index_t const* index, size_t page_address)
+{
+    // the first descriptor to claim any byte on the page decides the entry.
+    for (size_t i = 0; i < index->num_descriptors; ++i)
+    {
+        const int kind = classify_page(index->descriptors[i], page_address);
+        if (kind != PAGE_NONE)
+        {
+            return PAGE_ENTRY(kind, i);
+        }
+    }
+    
+    return PAGE_ENTRY(PAGE_NONE, 0);
+}
+
+// returns NULL if there is no leaf for this address (and create is false, or allocation failed).
+static page_entry_t* index_get_leaf(memory_index_t* index, size_t emulated_address, bool create)
+{
+    const size_t leaf_index = emulated_address >> (PAGE_BITS + LEAF_BITS);
+    page_entry_t** slot;
+    
+    if (leaf_index < DIRECTORY_SIZE)
+    {
+        if (!index->directory) return NULL;
+        slot = &index->directory[leaf_index];
+    }
+    else
+    {
+        if (!index->upper_leaves) return NULL;
+        slot = (page_entry_t**)retro_script_hashmap_get(index->upper_leaves, leaf_index);
+        if (!slot)
+        {
+            if (!create) return NULL;
+            slot = (page_entry_t**)retro_script_hashmap_add(index->upper_leaves, leaf_index);
+            if (!slot) return NULL;
+            *slot = NULL;
+        }
+    }
+    
+    if (!*slot && create)
+    {
+        page_entry_t** leaves = (page_entry_t**)realloc(index->leaves, sizeof(page_entry_t*) * (index->num_leaves + 1));
+        if (!leaves) return NULL;
+        index->leaves = leaves;
+        
+        // (PAGE_UNKNOWN is zero.)
+        *slot = (page_entry_t*)calloc(LEAF_SIZE, sizeof(page_entry_t));
+        if (!*slot) return NULL;
+        index->leaves[index->num_leaves++] = *slot;
+    }
+    
+    return *slot;
+}
+
+static page_entry_t index_get_page_entry(memory_index_t const* index, size_t emulated_address)
+{
+    page_entry_t const* leaf = index_get_leaf((memory_index_t*)index, emulated_address, false);
+    if (!leaf) return PAGE_ENTRY(PAGE_UNKNOWN, 0);
+    return leaf[(emulated_address >> PAGE_BITS) & (LEAF_SIZE - 1)];
+}
+
+// classifies the pages spanned by each descriptor.
+static void build_index(memory_index_t* index)
+{
+    index->directory = (page_entry_t**)calloc(DIRECTORY_SIZE, sizeof(page_entry_t*));
+    index->upper_leaves = retro_script_hashmap_create(sizeof(page_entry_t*));
+    if (!index->directory || !index->upper_leaves) return;
+    
+    size_t budget = MAX_INDEXED_PAGES;
+    for (size_t i = 0; i < index->num_descriptors; ++i)
+    {
+        struct retro_memory_descriptor const* descriptor = index->descriptors[i];
+        descriptor_translation_t const* translation = get_translation(descriptor);
+        if (!translation->linear)
+        {
+            // visit each page whose select bits match, in increasing order.
+            const size_t free_pages = ~translation->select >> PAGE_BITS;
+            const size_t base = (descriptor->start >> PAGE_BITS) & ~free_pages;
+            size_t sub = 0;
+            do
+            {
+                const size_t page = base | sub;
+                page_entry_t* leaf = index_get_leaf(index, page << PAGE_BITS, true);
+                if (!leaf) return;
+                
+                page_entry_t* entry = &leaf[page & (LEAF_SIZE - 1)];
+                if (*entry == PAGE_ENTRY(PAGE_UNKNOWN, 0))
+                {
+                    *entry = classify_page_entry(index, page << PAGE_BITS);
+                    --budget;
+                }
+                
+                sub = (sub - free_pages) & free_pages;
+            } while (sub && budget > 0);
+            continue;
+        }
+        if (descriptor->len == 0) continue;
+        
+        size_t end = descriptor->start + descriptor->len - 1;
+        if (end < descriptor->start) end = SIZE_MAX;
+        
+        const size_t last = end >> PAGE_BITS;
+        for (size_t page = descriptor->start >> PAGE_BITS; budget > 0; ++page)
+        {
+            page_entry_t* leaf = index_get_leaf(index, page << PAGE_BITS, true);
+            if (!leaf) return;
+            
+            page_entry_t* entry = &leaf[page & (LEAF_SIZE - 1)];
+            if (*entry == PAGE_ENTRY(PAGE_UNKNOWN, 0))
+            {
+                *entry = classify_page_entry(index, page << PAGE_BITS);
+                --budget;
+            }
+            
+            if (page == last) break;
+        }
+    }
+}
+
+// number of consecutive emulated addresses, starting at the given one (which the
+// descriptor maps to the given offset), that map contiguously into the descriptor.
+static FORCEINLINE size_t descriptor_run(struct retro_memory_descriptor const* descriptor, size_t emulated_address, size_t offset)
+{
+    descriptor_translation_t const* translation = get_translation(descriptor);
+    size_t run = descriptor->len - offset;
+    if (!translation->linear)
+    {
+        // the offset increases linearly up to the next select, disconnected, or ignored bit.
+        if (translation->block)
+        {
+            const size_t block = translation->block - (emulated_address & (translation->block - 1));
+            if (block < run) run = block;
+        }
+        
+        // and, if len folded the address, as long as the same bits are cleared.
+        if (!translation->len_is_pow2)
+        {
+            const size_t raw = translation_extract(translation, emulated_address);
+            if (raw != offset)
+            {
+                const size_t low_bit = lowest_bit(raw ^ offset);
+                const size_t fold = low_bit - (raw & (low_bit - 1));
+                if (fold < run) run = fold;
+            }
+        }
+    }
+    else if (descriptor->disconnect)
+    {
+        // the masked address only increases linearly up to the next disconnected bit.
+        const size_t low_bit = descriptor->disconnect & (~descriptor->disconnect + 1);
+        const size_t block = low_bit - (emulated_address & (low_bit - 1));
+        if (block < run) run = block;
+    }
+    return run;
+}
+
+// number of consecutive emulated addresses, starting at the given one, that the descriptor
+// does not claim. This may underestimate, but never overestimates.
+static FORCEINLINE size_t descriptor_gap(struct retro_memory_descriptor const* descriptor, size_t emulated_address)
+{
+    descriptor_translation_t const* translation = get_translation(descriptor);
+    if (!translation->linear)
+    {
+        const size_t mismatch = (emulated_address ^ descriptor->start) & translation->select;
+        if (!mismatch) return 0;
+        
+        // the address is not claimed until its highest mismatched bit changes.
+        const size_t bit = highest_bit(mismatch);
+        return bit - (emulated_address & (bit - 1));
+    }
+    
+    if (descriptor->len == 0) return SIZE_MAX;
+    
+    size_t gap = SIZE_MAX;
+    if (descriptor->disconnect)
+    {
+        const size_t low_bit = descriptor->disconnect & (~descriptor->disconnect + 1);
+        gap = low_bit - (emulated_address & (low_bit - 1));
+    }
+    
+    const size_t addr = emulated_address & ~descriptor->disconnect;
+    if (addr < descriptor->start)
+    {
+        if (descriptor->start - addr < gap) gap = descriptor->start - addr;
+    }
+    else if (addr - descriptor->start < descriptor->len)
+    {
+        return 0;
+    }
+    
+    return gap;
+}
+
+// as index_find_descriptor, but also sets span to the number of consecutive emulated addresses
+// (at least 1, and reported up to at least limit if possible) which are resolved to contiguous
+// bytes of the same descriptor.
+static struct retro_memory_descriptor* index_find_span(memory_index_t const* index, size_t emulated_address, size_t limit, size_t* offset, size_t* span)
+{
+    const page_entry_t entry = index_get_page_entry(index, emulated_address);
+    const size_t page_remaining = PAGE_SIZE - (emulated_address & (PAGE_SIZE - 1));
+    size_t first = 0;
+    
+    switch (PAGE_KIND(entry))
+    {
+    case PAGE_NONE:
+        return NULL;
+    case PAGE_FULL:
+        {
+            struct retro_memory_descriptor* descriptor = index->descriptors[PAGE_INDEX(entry)];
+            *offset = translation_offset(descriptor, get_translation(descriptor), emulated_address);
+            const size_t run = descriptor_run(descriptor, emulated_address, *offset);
+            
+            // extend across following pages fully mapped by the same descriptor.
+            size_t extent = page_remaining;
+            while (extent < run && extent < limit && index_get_page_entry(index, emulated_address + extent) == entry)
+            {
+                extent += PAGE_SIZE;
+            }
+            
+            *span = (extent < run) ? extent : run;
+            return descriptor;
+        }
+    case PAGE_PARTIAL:
+        first = PAGE_INDEX(entry);
+        break;
+    }
+    
+    for (size_t i = first; i < index->num_descriptors; ++i)
+    {
+        struct retro_memory_descriptor* descriptor = index->descriptors[i];
+        if (descriptor_contains(descriptor, emulated_address, offset))
+        {
+            size_t run = descriptor_run(descriptor, emulated_address, *offset);
+            
+            // an earlier descriptor takes precedence wherever it starts to claim addresses.
+            for (size_t k = first; k < i; ++k)
+            {
+                const size_t gap = descriptor_gap(index->descriptors[k], emulated_address);
+                if (gap < run) run = gap;
+            }
+            
+            // descriptors before the first are only known not to claim anything on this page.
+            if (PAGE_KIND(entry) == PAGE_PARTIAL && page_remaining < run)
+            {
+                run = page_remaining;
+            }
+            
+            *span = run;
+            return descriptor;
+        }
+    }
+    
+    return NULL;
+}
+
+static struct retro_memory_descriptor* index_find_descriptor(memory_index_t const* index, size_t emulated_address, size_t* offset)
+{
+    const page_entry_t entry = index_get_page_entry(index, emulated_address);
+    size_t i = 0;
+    
+    switch (PAGE_KIND(entry))
+    {
+    case PAGE_NONE:
+        return NULL;
+    case PAGE_FULL:
+        {
+            struct retro_memory_descriptor* descriptor = index->descriptors[PAGE_INDEX(entry)];
+            *offset = translation_offset(descriptor, get_translation(descriptor), emulated_address);
+            return descriptor;
+        }
+    case PAGE_PARTIAL:
+        i = PAGE_INDEX(entry);
+        break;
+    }
+    
+    for (; i < index->num_descriptors; ++i)
+    {
+        if (descriptor_contains(index->descriptors[i], emulated_address, offset))
+        {
+            return index->descriptors[i];
+        }
+    }
+    
+    return NULL;
 }
 
 char const* const* retro_script_list_memory_addrspaces()
@@ -62,10 +678,13 @@ bool retro_script_set_memory_map(struct retro_memory_map* core_memmap)
         {
             struct retro_memory_descriptor* descriptor = (struct retro_memory_descriptor*)&memmap.descriptors[i];
             
+            // NULL is treated as empty.
+            const char* descriptor_addrspace = descriptor->addrspace ? descriptor->addrspace : "";
+            
             char** addrspace;
             for (addrspace = addrspaces; addrspace && *addrspace; ++addrspace)
             {
-                if ((*addrspace == descriptor->addrspace) || strcmp(*addrspace, descriptor->addrspace) == 0)
+                if ((*addrspace == descriptor_addrspace) || strcmp(*addrspace, descriptor_addrspace) == 0)
                 {
                     // reuse store entry
                     descriptor->addrspace = *addrspace;
@@ -75,34 +694,192 @@ bool retro_script_set_memory_map(struct retro_memory_map* core_memmap)
             // else
             {
                 // duplicate string to static store.
-                *addrspace = descriptor->addrspace ? retro_script_strdup(descriptor->addrspace) : NULL;
+                *addrspace = retro_script_strdup(descriptor_addrspace);
                 descriptor->addrspace = *addrspace;
             }
         
         next_descriptor:
             continue;
         }
+        
+        // every bit which any address in the memory map can use.
+        size_t top = 1;
+        for (size_t i = 0; i < memmap.num_descriptors; ++i)
+        {
+            struct retro_memory_descriptor const* descriptor = &memmap.descriptors[i];
+            if (descriptor->select)
+            {
+                top |= descriptor->select;
+            }
+            else if (descriptor->len)
+            {
+                top |= descriptor->start + descriptor->len - 1;
+            }
+        }
+        top = add_bits_down(top);
+        
+        translations = malloc_array(descriptor_translation_t, memmap.num_descriptors ? memmap.num_descriptors : 1);
+        if (!translations)
+        {
+            free_memmap();
+            return false;
+        }
+        for (size_t i = 0; i < memmap.num_descriptors; ++i)
+        {
+            compile_translation((struct retro_memory_descriptor*)&memmap.descriptors[i], &translations[i], top);
+        }
+        
+        // index every descriptor.
+        memmap_index.num_descriptors = memmap.num_descriptors;
+        memmap_index.descriptors = malloc_array(struct retro_memory_descriptor*, memmap.num_descriptors);
+        if (memmap_index.descriptors)
+        {
+            for (size_t i = 0; i < memmap.num_descriptors; ++i)
+            {
+                memmap_index.descriptors[i] = (struct retro_memory_descriptor*)&memmap.descriptors[i];
+            }
+            build_index(&memmap_index);
+        }
+        else
+        {
+            memmap_index.num_descriptors = 0;
+        }
+        
+        // index each addrspace separately.
+        for (char** addrspace = addrspaces; addrspace && *addrspace; ++addrspace)
+        {
+            ++num_addrspaces;
+        }
+        addrspace_indices = (memory_index_t*)calloc(num_addrspaces ? num_addrspaces : 1, sizeof(memory_index_t));
+        if (!addrspace_indices) num_addrspaces = 0;
+        for (size_t k = 0; k < num_addrspaces; ++k)
+        {
+            memory_index_t* index = &addrspace_indices[k];
+            index->descriptors = malloc_array(struct retro_memory_descriptor*, memmap.num_descriptors ? memmap.num_descriptors : 1);
+            if (!index->descriptors) continue;
+            
+            for (size_t i = 0; i < memmap.num_descriptors; ++i)
+            {
+                // (addrspace strings are interned above, so pointers can be compared.)
+                if (memmap.descriptors[i].addrspace == addrspaces[k])
+                {
+                    index->descriptors[index->num_descriptors++] = (struct retro_memory_descriptor*)&memmap.descriptors[i];
+                }
+            }
+            build_index(index);
+        }
     }
     
     return false;
 }
 
-struct retro_memory_descriptor* retro_script_memory_find_descriptor_at_address(size_t emulated_address, size_t* offset)
+// returns the index for the given addrspace (NULL meaning all addrspaces), or NULL if there is no such addrspace.
+static memory_index_t const* find_index(const char* addrspace)
 {
-    for (size_t i = 0; i < memmap.num_descriptors; ++i)
+    if (!addrspace) return &memmap_index;
+    
+    for (size_t i = 0; i < num_addrspaces; ++i)
     {
-        struct retro_memory_descriptor* descriptor = (struct retro_memory_descriptor*)&memmap.descriptors[i];
-        size_t addr = emulated_address & ~descriptor->disconnect;
-        if (addr < descriptor->start) continue;
-        addr -= descriptor->start;
-        if (addr >= descriptor->len) continue;
-        *offset = addr;
-        return descriptor;
+        if (strcmp(addrspaces[i], addrspace) == 0) return &addrspace_indices[i];
     }
     
     return NULL;
 }
 
+struct retro_memory_descriptor* retro_script_memory_find_descriptor_at_address(size_t emulated_address, size_t* offset)
+{
+    return index_find_descriptor(&memmap_index, emulated_address, offset);
+}
+
+struct retro_memory_descriptor* retro_script_memory_find_descriptor_at_address_in(const char* addrspace, size_t emulated_address, size_t* offset)
+{
+    memory_index_t const* index = find_index(addrspace);
+    if (!index) return NULL;
+    return index_find_descriptor(index, emulated_address, offset);
+}
+
+struct retro_memory_descriptor const* retro_script_memory_get_descriptors(size_t* num_descriptors)
+{
+    *num_descriptors = memmap.num_descriptors;
+    return memmap.descriptors;
+}
+
+// the lowest emulated address which the descriptor maps to the given offset, ignoring other descriptors.
+// (the inverse of descriptor_contains.)
+static FORCEINLINE size_t descriptor_base_address(struct retro_memory_descriptor const* descriptor, descriptor_translation_t const* translation, size_t offset)
+{
+    if (translation->linear) return descriptor->start + offset;
+    
+    #ifdef MEMMAP_BMI2
+    return descriptor->start | ((size_t)_pdep_u64(offset, translation->extract) & ~translation->select);
+    #else
+    return descriptor->start | (deposit_bits(offset, translation->extract) & ~translation->select);
+    #endif
+}
+
+bool retro_script_memory_descriptor_locate_in(const char* addrspace, struct retro_memory_descriptor const* descriptor, size_t offset, size_t* emulated_address, size_t* run)
+{
+    memory_index_t const* index = find_index(addrspace);
+    descriptor_translation_t const* translation = get_translation(descriptor);
+    const size_t remaining = descriptor->len - offset;
+    *run = remaining;
+    if (!index) return false;
+    
+    size_t mirror_bits = 0;
+    if (!translation->linear)
+    {
+        // offset bits which extract takes from select bits are always cleared, so an offset with
+        // any of them set is unreachable up to the next offset where they are all clear again.
+        const size_t cleared = extract_bits(translation->extract & translation->select, translation->extract);
+        if (offset & cleared)
+        {
+            size_t next = offset;
+            while (next & cleared)
+            {
+                next = (next | (lowest_bit(next & cleared) - 1)) + 1;
+            }
+            if (next - offset < remaining) *run = next - offset;
+            return false;
+        }
+        mirror_bits = ~translation->select & ~translation->extract;
+    }
+    
+    // an earlier descriptor may claim the lowest mirror, so try the next few. Each mirror which another
+    // descriptor claims stays claimed for its span, so if all are claimed, so are the offsets up to the shortest span.
+    const size_t base = descriptor_base_address(descriptor, translation, offset);
+    size_t skip = descriptor_run(descriptor, base, offset);
+    size_t sub = 0;
+    for (int tries = 0; tries < 64; ++tries)
+    {
+        size_t found_offset;
+        size_t span;
+        struct retro_memory_descriptor* found = index_find_span(index, base | sub, skip, &found_offset, &span);
+        if (found == descriptor && found_offset == offset)
+        {
+            *emulated_address = base | sub;
+            *run = (span < skip) ? span : skip;
+            return true;
+        }
+        if (!found || found == descriptor) span = 1;
+        if (span < skip) skip = span;
+        
+        sub = (sub - mirror_bits) & mirror_bits;
+        if (!sub)
+        {
+            *run = skip;
+            return false;
+        }
+    }
+    
+    *run = 1;
+    return false;
+}
+
+uint32_t retro_script_memory_map_generation()
+{
+    return memmap_generation;
+}
+
 static char* get_address_from_descriptor_and_offset(struct retro_memory_descriptor* descriptor, size_t offset)
 {
     if (offset > descriptor->len)
@@ -128,67 +905,238 @@ char* retro_script_memory_access(size_t emulated_address)
     }
 }
 
-#define SYS_IS_BIGENDIAN (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+char* retro_script_memory_access_range(size_t emulated_address, size_t count, bool* is_const)
+{
+    return retro_script_memory_access_range_in(NULL, emulated_address, count, is_const);
+}
+
+char* retro_script_memory_access_range_in(const char* addrspace, size_t emulated_address, size_t count, bool* is_const)
+{
+    memory_index_t const* index = find_index(addrspace);
+    if (!index) return NULL;
+    
+    size_t offset, span;
+    struct retro_memory_descriptor* descriptor = index_find_span(index, emulated_address, count, &offset, &span);
+    
+    if (!descriptor || !descriptor->ptr || span < count) return NULL;
+    
+    if (is_const) *is_const = !!(descriptor->flags & RETRO_MEMDESC_CONST);
+    return get_address_from_descriptor_and_offset(descriptor, offset);
+}
 
-static char readbuff[8];
-static FORCEINLINE char* readmem_chunk(size_t emulated_address, size_t count, bool flip)
+char* retro_script_memory_access_span_in(const char* addrspace, size_t emulated_address, size_t count, size_t* span, struct retro_memory_descriptor const** descriptor)
 {
-    for (size_t i = 0; i < count; ++i)
+    memory_index_t const* index = find_index(addrspace);
+    if (!index) return NULL;
+    
+    size_t offset;
+    struct retro_memory_descriptor* found = index_find_span(index, emulated_address, count, &offset, span);
+    if (!found || !found->ptr) return NULL;
+    
+    if (*span > count) *span = count;
+    if (descriptor) *descriptor = found;
+    return get_address_from_descriptor_and_offset(found, offset);
+}
+
+bool retro_script_memory_read_bytes(size_t emulated_address, void* out, size_t count)
+{
+    return retro_script_memory_read_bytes_in(NULL, emulated_address, out, count);
+}
+
+bool retro_script_memory_read_bytes_in(const char* addrspace, size_t emulated_address, void* out, size_t count)
+{
+    memory_index_t const* index = find_index(addrspace);
+    if (!index) return false;
+    
+    char* dst = (char*)out;
+    while (count > 0)
     {
-        size_t offset;
-        struct retro_memory_descriptor* descriptor = retro_script_memory_find_descriptor_at_address(emulated_address, &offset);
+        size_t offset, span;
+        struct retro_memory_descriptor* descriptor = index_find_span(index, emulated_address, count, &offset, &span);
         
         // no valid memory chunk; fail.
-        if (!descriptor) return NULL;
+        if (!descriptor || !descriptor->ptr) return false;
         
-        // return direct access if possible
-        if (!flip && i == 0 && offset + count <= descriptor->len)
-        {
-            return get_address_from_descriptor_and_offset(descriptor, offset);
-        }
+        if (span > count) span = count;
+        const char* host = get_address_from_descriptor_and_offset(descriptor, offset);
+        memcpy(dst, host, span);
         
-        // otherwise, copy to buffer and return the buffer.
-        for (; offset < descriptor->len; ++offset, ++i)
-        {
-            size_t index = flip ? (count - i - 1) : i;
-            if (index < sizeof(readbuff))
-                readbuff[index] = *get_address_from_descriptor_and_offset(descriptor, offset);
-        }
+        dst += span;
+        emulated_address += span;
+        count -= span;
     }
     
-    return readbuff;
+    return true;
 }
 
+bool retro_script_memory_write_bytes(size_t emulated_address, const void* in, size_t count)
+{
+    return retro_script_memory_write_bytes_in(NULL, emulated_address, in, count);
+}
 
-static FORCEINLINE bool writemem_chunk(size_t emulated_address, const char* data, size_t count, bool flip)
+bool retro_script_memory_write_bytes_in(const char* addrspace, size_t emulated_address, const void* in, size_t count)
 {
-    for (int k = 0; k <= 1; ++k) // on first pass, just check that there is enough room.
+    memory_index_t const* index = find_index(addrspace);
+    if (!index) return false;
+    
+    for (int k = 0; k <= 1; ++k) // on first pass, just check that the whole range is writeable.
     {
-        for (size_t i = 0; i < count; ++i)
+        const char* src = (const char*)in;
+        size_t address = emulated_address;
+        size_t remaining = count;
+        while (remaining > 0)
         {
-            size_t offset;
-            struct retro_memory_descriptor* descriptor = retro_script_memory_find_descriptor_at_address(emulated_address, &offset);
+            size_t offset, span;
+            struct retro_memory_descriptor* descriptor = index_find_span(index, address, remaining, &offset, &span);
             
             // no writeable chunk; fail.
-            if (!descriptor || (descriptor->flags & RETRO_MEMDESC_CONST)) return false;
+            if (!descriptor || !descriptor->ptr || (descriptor->flags & RETRO_MEMDESC_CONST)) return false;
             
+            if (span > remaining) span = remaining;
             if (k == 1)
             {
-                // directly write.
-                for (; offset < descriptor->len; ++offset, ++i)
-                {
-                    *get_address_from_descriptor_and_offset(descriptor, offset)
-                        = data[flip ? (count - i - 1) : i];
-                }
+                memcpy(get_address_from_descriptor_and_offset(descriptor, offset), src, span);
             }
             
-            i += descriptor->len - offset;
+            src += span;
+            address += span;
+            remaining -= span;
         }
     }
     
     return true;
 }
 
+static FORCEINLINE uint64_t bitfield_mask(unsigned width)
+{
+    return (width >= 64) ? ~(uint64_t)0 : (((uint64_t)1 << width) - 1);
+}
+
+size_t retro_script_memory_bitfield_bytes(size_t* emulated_address, size_t* bit_offset, unsigned width)
+{
+    *emulated_address += *bit_offset / 8;
+    *bit_offset %= 8;
+    return (*bit_offset + width + 7) / 8;
+}
+
+// the first count (at most 8) bytes, as an integer aligned to the most significant end (big-endian)
+// or least significant end (little-endian).
+static uint64_t bitfield_load(const uint8_t* bytes, size_t count, bool big_endian)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (big_endian)
+        {
+            v |= (uint64_t)bytes[i] << (56 - 8 * i);
+        }
+        else
+        {
+            v |= (uint64_t)bytes[i] << (8 * i);
+        }
+    }
+    return v;
+}
+
+static void bitfield_store(uint8_t* bytes, size_t count, bool big_endian, uint64_t v)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        bytes[i] = (uint8_t)(big_endian ? v >> (56 - 8 * i) : v >> (8 * i));
+    }
+}
+
+uint64_t retro_script_memory_bitfield_get(const uint8_t* bytes, size_t count, size_t bit_offset, unsigned width, bool big_endian)
+{
+    const size_t head = (count > 8) ? 8 : count;
+    uint64_t v = bitfield_load(bytes, head, big_endian);
+    if (big_endian)
+    {
+        // bits are numbered from the most significant bit of the first byte.
+        v <<= bit_offset;
+        if (count > 8) v |= bytes[8] >> (8 - bit_offset);
+        v >>= 64 - width;
+    }
+    else
+    {
+        // bits are numbered from the least significant bit of the first byte.
+        v >>= bit_offset;
+        if (count > 8) v |= (uint64_t)bytes[8] << (64 - bit_offset);
+        v &= bitfield_mask(width);
+    }
+    return v;
+}
+
+void retro_script_memory_bitfield_set(uint8_t* bytes, size_t count, size_t bit_offset, unsigned width, bool big_endian, uint64_t in)
+{
+    const size_t head = (count > 8) ? 8 : count;
+    const uint64_t mask = bitfield_mask(width);
+    in &= mask;
+    
+    uint64_t v = bitfield_load(bytes, head, big_endian);
+    if (big_endian)
+    {
+        // field and mask aligned to the most significant bit, then moved to the bit offset.
+        const uint64_t field = in << (64 - width);
+        const uint64_t field_mask = mask << (64 - width);
+        v = (v & ~(field_mask >> bit_offset)) | (field >> bit_offset);
+        if (count > 8)
+        {
+            const uint8_t tail_mask = (uint8_t)((field_mask << (64 - bit_offset)) >> 56);
+            bytes[8] = (bytes[8] & ~tail_mask) | (uint8_t)((field << (64 - bit_offset)) >> 56);
+        }
+    }
+    else
+    {
+        v = (v & ~(mask << bit_offset)) | (in << bit_offset);
+        if (count > 8)
+        {
+            const uint8_t tail_mask = (uint8_t)(mask >> (64 - bit_offset));
+            bytes[8] = (bytes[8] & ~tail_mask) | (uint8_t)(in >> (64 - bit_offset));
+        }
+    }
+    bitfield_store(bytes, head, big_endian, v);
+}
+
+bool retro_script_memory_read_bits_in(const char* addrspace, size_t emulated_address, size_t bit_offset, unsigned width, bool big_endian, uint64_t* out)
+{
+    if (width == 0 || width > 64) return false;
+    
+    const size_t count = retro_script_memory_bitfield_bytes(&emulated_address, &bit_offset, width);
+    uint8_t bytes[MEMORY_MAX_BITFIELD_BYTES];
+    if (!retro_script_memory_read_bytes_in(addrspace, emulated_address, bytes, count)) return false;
+    
+    *out = retro_script_memory_bitfield_get(bytes, count, bit_offset, width, big_endian);
+    return true;
+}
+
+bool retro_script_memory_write_bits_in(const char* addrspace, size_t emulated_address, size_t bit_offset, unsigned width, bool big_endian, uint64_t in)
+{
+    if (width == 0 || width > 64) return false;
+    
+    const size_t count = retro_script_memory_bitfield_bytes(&emulated_address, &bit_offset, width);
+    uint8_t bytes[MEMORY_MAX_BITFIELD_BYTES];
+    if (!retro_script_memory_read_bytes_in(addrspace, emulated_address, bytes, count)) return false;
+    
+    retro_script_memory_bitfield_set(bytes, count, bit_offset, width, big_endian, in);
+    return retro_script_memory_write_bytes_in(addrspace, emulated_address, bytes, count);
+}
+
+// reads into caller-owned storage, so that concurrent reads do not share any buffer.
+static FORCEINLINE bool readmem_chunk(size_t emulated_address, void* out, size_t count, bool flip)
+{
+    if (!retro_script_memory_read_bytes(emulated_address, out, count)) return false;
+    if (flip) retro_script_bswap_value(out, count);
+    return true;
+}
+
+// data is modified if flip is set.
+static FORCEINLINE bool writemem_chunk(size_t emulated_address, void* data, size_t count, bool flip)
+{
+    if (flip) retro_script_bswap_value(data, count);
+    return retro_script_memory_write_bytes(emulated_address, data, count);
+}
+
 bool retro_script_memory_read_char(size_t emulated_address, char* out)
 {
     const char* data = retro_script_memory_access(emulated_address);
@@ -234,17 +1182,17 @@ static const int le = 1;
 #define MEMORY_READ_WRITE(type, ctype, le) \
 bool retro_script_memory_read_##type##_##le(size_t emulated_address, ctype* out) \
 { \
-    char* data = readmem_chunk(emulated_address, sizeof(ctype), le == SYS_IS_BIGENDIAN ); \
-    if (data) \
+    ctype v; \
+    if (readmem_chunk(emulated_address, &v, sizeof(ctype), le == SYS_IS_BIGENDIAN)) \
     { \
-        *out = *(ctype*)data; \
+        *out = v; \
         return true; \
     } \
     return false; \
 } \
 bool retro_script_memory_write_##type##_##le(size_t emulated_address, ctype in) \
 { \
-    return writemem_chunk(emulated_address, (char*)(void*)&in, sizeof(ctype), le == SYS_IS_BIGENDIAN); \
+    return writemem_chunk(emulated_address, &in, sizeof(ctype), le == SYS_IS_BIGENDIAN); \
 }
 
 MEMORY_READ_WRITE(int16, int16_t, le);
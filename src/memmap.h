@@ -3,6 +3,9 @@
 #include <libretro.h>
 #include <stdlib.h>
 
+// the memory accessors below keep no shared mutable state, so they may be called concurrently
+// from any thread, provided the memory map is not being set or cleared at the same time.
+
 bool retro_script_set_memory_map(struct retro_memory_map*);
 void retro_script_clear_memory_map();
 
@@ -10,6 +13,54 @@ char const* const* retro_script_list_memory_addrspaces();
 struct retro_memory_descriptor* retro_script_memory_find_descriptor_at_address(size_t emulated_address, size_t* offset);
 char* retro_script_memory_access(size_t emulated_address);
 
+// returns a host pointer through which count consecutive bytes from the given address can be
+// accessed directly, or NULL if the range is not mapped contiguously.
+// is_const (optional) is set if the memory must not be written.
+char* retro_script_memory_access_range(size_t emulated_address, size_t count, bool* is_const);
+
+// the descriptors of the memory map, in the order the core provided them.
+struct retro_memory_descriptor const* retro_script_memory_get_descriptors(size_t* num_descriptors);
+
+// finds an emulated address through which the given offset of the descriptor can be reached in the given addrspace
+// (NULL meaning all addrspaces), preferring the lowest which no earlier descriptor claims, and sets run to the
+// number of consecutive offsets reachable from there at consecutive addresses. If there is no such address, returns false
+// and sets run to the number of consecutive offsets (at least 1) known to be unreachable. The offset must be below len.
+bool retro_script_memory_descriptor_locate_in(const char* addrspace, struct retro_memory_descriptor const*, size_t offset, size_t* emulated_address, size_t* run);
+
+// incremented every time the memory map changes; previously obtained host pointers must then be re-resolved.
+uint32_t retro_script_memory_map_generation();
+
+// copies count bytes, which may span several descriptors.
+// these return false if any byte in the range is unmapped (or, for writing, const);
+// a failed write leaves memory unmodified.
+bool retro_script_memory_read_bytes(size_t emulated_address, void* out, size_t count);
+bool retro_script_memory_write_bytes(size_t emulated_address, const void* in, size_t count);
+
+// as above, but only considering the descriptors of the given addrspace ("" for descriptors without one).
+// a NULL addrspace considers all descriptors, as the unqualified functions do. An unknown addrspace maps nothing.
+struct retro_memory_descriptor* retro_script_memory_find_descriptor_at_address_in(const char* addrspace, size_t emulated_address, size_t* offset);
+char* retro_script_memory_access_range_in(const char* addrspace, size_t emulated_address, size_t count, bool* is_const);
+
+// the host memory at the given address in the given addrspace, or NULL if unmapped. span is set to how many of the
+// count bytes from there are contiguous in host memory, and descriptor (optional) to the descriptor mapping them.
+char* retro_script_memory_access_span_in(const char* addrspace, size_t emulated_address, size_t count, size_t* span, struct retro_memory_descriptor const** descriptor);
+bool retro_script_memory_read_bytes_in(const char* addrspace, size_t emulated_address, void* out, size_t count);
+bool retro_script_memory_write_bytes_in(const char* addrspace, size_t emulated_address, const void* in, size_t count);
+
+// reads/writes a bitfield of 1 to 64 bits, starting bit_offset bits into the given address.
+// little-endian bits are numbered from the least significant bit of the first byte, and big-endian
+// bits from the most significant bit. Writing modifies only the bits of the field.
+bool retro_script_memory_read_bits_in(const char* addrspace, size_t emulated_address, size_t bit_offset, unsigned width, bool big_endian, uint64_t* out);
+bool retro_script_memory_write_bits_in(const char* addrspace, size_t emulated_address, size_t bit_offset, unsigned width, bool big_endian, uint64_t in);
+
+// the bytes underlying a bitfield, for accessing it by other means: bitfield_bytes moves the bit offset to within
+// the first byte (adjusting the address) and returns the number of bytes the field spans (at most
+// MEMORY_MAX_BITFIELD_BYTES); get and set then extract or replace the field within those bytes.
+#define MEMORY_MAX_BITFIELD_BYTES 9
+size_t retro_script_memory_bitfield_bytes(size_t* emulated_address, size_t* bit_offset, unsigned width);
+uint64_t retro_script_memory_bitfield_get(const uint8_t* bytes, size_t count, size_t bit_offset, unsigned width, bool big_endian);
+void retro_script_memory_bitfield_set(uint8_t* bytes, size_t count, size_t bit_offset, unsigned width, bool big_endian, uint64_t in);
+
 // these all return false if an error occurred, true if successful.
 bool retro_script_memory_read_char(size_t emulated_address, char* out);
 bool retro_script_memory_read_byte(size_t emulated_address, unsigned char* out);
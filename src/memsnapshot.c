@@ -0,0 +1,311 @@
+#include "l.h"
+#include "memsnapshot.h"
+#include "memmap.h"
+#include "script.h"
+#include "script_list.h"
+#include "util.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define MEMSNAPSHOT_SSE2
+    #include <emmintrin.h>
+#endif
+
+// a writable descriptor, and where its bytes are kept in the pool.
+typedef struct snapshot_region
+{
+    struct retro_memory_descriptor const* descriptor;
+    const char* host;
+    size_t len;
+    size_t pool_offset;
+} snapshot_region_t;
+
+static struct
+{
+    snapshot_region_t* regions;
+    size_t num_regions;
+    
+    // the copy of every region from before the frame, followed by the copy from after.
+    char* pool;
+    size_t pool_size;
+    
+    // memory map generation the regions were collected for.
+    uint32_t generation;
+    
+    bool before_taken;
+    
+    // both copies were taken around the latest frame.
+    bool valid;
+} snapshot;
+
+static int _lua_error(lua_State* L, const char* message)
+{
+    return luaL_error(L, "%s", message);
+}
+
+static bool snapshots_wanted()
+{
+    SCRIPT_ITERATE(script_state)
+    {
+        if (script_state->snapshot_frames) return true;
+    }
+    return false;
+}
+
+static void snapshot_free()
+{
+    if (snapshot.regions) free(snapshot.regions);
+    if (snapshot.pool) free(snapshot.pool);
+    memset(&snapshot, 0, sizeof(snapshot));
+}
+
+static bool snapshot_collect()
+{
+    snapshot_free();
+    
+    size_t num_descriptors;
+    struct retro_memory_descriptor const* descriptors = retro_script_memory_get_descriptors(&num_descriptors);
+    
+    snapshot.regions = malloc_array(snapshot_region_t, num_descriptors ? num_descriptors : 1);
+    if (!snapshot.regions) return false;
+    
+    for (size_t i = 0; i < num_descriptors; ++i)
+    {
+        struct retro_memory_descriptor const* descriptor = &descriptors[i];
+        if (!descriptor->ptr || descriptor->len == 0 || (descriptor->flags & RETRO_MEMDESC_CONST)) continue;
+        
+        const char* host = (const char*)descriptor->ptr + descriptor->offset;
+        
+        // skip descriptors which only mirror memory that is already covered.
+        for (size_t k = 0; k < snapshot.num_regions; ++k)
+        {
+            if (snapshot.regions[k].host == host && snapshot.regions[k].len >= descriptor->len) goto next_descriptor;
+        }
+        
+        {
+            snapshot_region_t* region = &snapshot.regions[snapshot.num_regions++];
+            region->descriptor = descriptor;
+            region->host = host;
+            region->len = descriptor->len;
+            region->pool_offset = snapshot.pool_size;
+            snapshot.pool_size += descriptor->len;
+        }
+    
+    next_descriptor:
+        continue;
+    }
+    
+    snapshot.pool = malloc_array(char, snapshot.pool_size ? 2 * snapshot.pool_size : 1);
+    if (!snapshot.pool)
+    {
+        snapshot_free();
+        return false;
+    }
+    
+    snapshot.generation = retro_script_memory_map_generation();
+    return true;
+}
+
+static void snapshot_copy(char* dst)
+{
+    for (size_t i = 0; i < snapshot.num_regions; ++i)
+    {
+        memcpy(dst + snapshot.regions[i].pool_offset, snapshot.regions[i].host, snapshot.regions[i].len);
+    }
+}
+
+void retro_script_memory_snapshot_before_run()
+{
+    snapshot.valid = false;
+    snapshot.before_taken = false;
+    
+    if (!snapshots_wanted())
+    {
+        if (snapshot.regions) snapshot_free();
+        return;
+    }
+    
+    if (!snapshot.regions || snapshot.generation != retro_script_memory_map_generation())
+    {
+        if (!snapshot_collect()) return;
+    }
+    
+    snapshot_copy(snapshot.pool);
+    snapshot.before_taken = true;
+}
+
+void retro_script_memory_snapshot_after_run()
+{
+    // (no diff is available for a frame during which the memory map changed.)
+    if (!snapshot.before_taken || snapshot.generation != retro_script_memory_map_generation()) return;
+    
+    snapshot_copy(snapshot.pool + snapshot.pool_size);
+    snapshot.before_taken = false;
+    snapshot.valid = true;
+}
+
+// bit i is set if a[i] differs from b[i], for 64 bytes.
+static FORCEINLINE uint64_t diff_mask64(const char* a, const char* b)
+{
+    uint64_t mask = 0;
+    #ifdef MEMSNAPSHOT_SSE2
+    for (unsigned i = 0; i < 64; i += 16)
+    {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        const __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        mask |= (uint64_t)(uint16_t)~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) << i;
+    }
+    #else
+    for (unsigned i = 0; i < 64; i += 8)
+    {
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+        if (x == y) continue;
+        for (unsigned k = i; k < i + 8; ++k)
+        {
+            mask |= (uint64_t)(a[k] != b[k]) << k;
+        }
+    }
+    #endif
+    return mask;
+}
+
+// accumulates changed ranges into the three result tables on top of the lua stack.
+typedef struct diff_output
+{
+    lua_State* L;
+    size_t gap;
+    size_t count;
+    
+    // pending range, as offsets into the descriptor (NULL if none).
+    struct retro_memory_descriptor const* descriptor;
+    size_t start;
+    size_t end;
+} diff_output_t;
+
+static void diff_flush(diff_output_t* out)
+{
+    if (!out->descriptor) return;
+    
+    lua_State* L = out->L;
+    
+    // offsets which are consecutive in the descriptor need not be at consecutive addresses (e.g. across a select
+    // or disconnect bit), so the range is reported as one range of addresses per contiguous run.
+    size_t offset = out->start;
+    while (offset < out->end)
+    {
+        // skip offsets which no address reaches (e.g. those behind a select bit) a run at a time; they cannot be read either.
+        size_t address;
+        size_t run;
+        const bool reachable = retro_script_memory_descriptor_locate_in(out->descriptor->addrspace, out->descriptor, offset, &address, &run);
+        if (run > out->end - offset) run = out->end - offset;
+        if (!reachable)
+        {
+            offset += run;
+            continue;
+        }
+        
+        ++out->count;
+        lua_pushinteger(L, address);
+        lua_rawseti(L, -4, out->count);
+        
+        lua_pushinteger(L, run);
+        lua_rawseti(L, -3, out->count);
+        
+        lua_pushstring(L, out->descriptor->addrspace ? out->descriptor->addrspace : "");
+        lua_rawseti(L, -2, out->count);
+        
+        offset += run;
+    }
+    
+    out->descriptor = NULL;
+}
+
+static FORCEINLINE void diff_emit(diff_output_t* out, struct retro_memory_descriptor const* descriptor, size_t start, size_t len)
+{
+    // ranges separated by no more than gap unchanged bytes are merged.
+    if (out->descriptor == descriptor && start - out->end <= out->gap)
+    {
+        out->end = start + len;
+        return;
+    }
+    
+    diff_flush(out);
+    out->descriptor = descriptor;
+    out->start = start;
+    out->end = start + len;
+}
+
+static void diff_region(diff_output_t* out, snapshot_region_t const* region)
+{
+    const char* a = snapshot.pool + region->pool_offset;
+    const char* b = a + snapshot.pool_size;
+    
+    size_t i = 0;
+    for (; i + 64 <= region->len; i += 64)
+    {
+        uint64_t mask = diff_mask64(a + i, b + i);
+        while (mask)
+        {
+            const unsigned first = retro_script_ctz64(mask);
+            
+            // (bits shifted in from the top are zero, so rest is nonzero unless the run reaches the end.)
+            const uint64_t rest = ~(mask >> first);
+            const unsigned len = rest ? retro_script_ctz64(rest) : 64 - first;
+            diff_emit(out, region->descriptor, i + first, len);
+            
+            mask = (first + len >= 64) ? 0 : mask & (~(uint64_t)0 << (first + len));
+        }
+    }
+    
+    for (; i < region->len; ++i)
+    {
+        if (a[i] != b[i]) diff_emit(out, region->descriptor, i, 1);
+    }
+}
+
+int retro_script_luafunc_snapshot_frames(lua_State* L)
+{
+    script_state_t* script = script_find_lua(L);
+    if (!script) return _lua_error(L, "invalid lua context");
+    
+    script->snapshot_frames = lua_gettop(L) < 1 || lua_toboolean(L, 1);
+    return 0;
+}
+
+int retro_script_luafunc_frame_diff(lua_State* L)
+{
+    size_t gap = 0;
+    if (lua_gettop(L) >= 1 && !lua_isnil(L, 1))
+    {
+        if (!lua_isinteger(L, 1) || lua_tointeger(L, 1) < 0) return _lua_error(L, "invalid gap for \"frame_diff\"");
+        gap = lua_tointeger(L, 1);
+    }
+    
+    // (the descriptors the regions refer to are freed when the memory map changes, e.g. before the next frame.)
+    if (!snapshot.valid || snapshot.generation != retro_script_memory_map_generation())
+    {
+        snapshot.valid = false;
+        return 0;
+    }
+    
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_newtable(L);
+    
+    diff_output_t out;
+    memset(&out, 0, sizeof(out));
+    out.L = L;
+    out.gap = gap;
+    
+    for (size_t i = 0; i < snapshot.num_regions; ++i)
+    {
+        diff_region(&out, &snapshot.regions[i]);
+    }
+    diff_flush(&out);
+    
+    return 3;
+}
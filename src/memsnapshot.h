@@ -0,0 +1,18 @@
+#pragma once
+
+/* snapshots of all writable memory, taken before and after each frame
+ * (while any script has requested them), for finding out what the core changed.
+ */
+
+struct lua_State;
+
+// called immediately before/after the core runs a frame.
+void retro_script_memory_snapshot_before_run();
+void retro_script_memory_snapshot_after_run();
+
+// lua args: enable
+int retro_script_luafunc_snapshot_frames(struct lua_State* L);
+
+// lua args: [gap]
+//      ret: array of addresses, array of lengths, array of addrspaces
+int retro_script_luafunc_frame_diff(struct lua_State* L);
@@ -0,0 +1,290 @@
+#include "l.h"
+#include "memstruct.h"
+#include "memmap.h"
+#include "memjournal.h"
+#include "memtype.h"
+#include "util.h"
+
+#include <stdint.h>
+
+// registry name of the metatable shared by all layouts.
+#define STRUCT_METATABLE "retro_script_memory_struct"
+
+typedef struct struct_field
+{
+    char* name;
+    size_t offset;
+    retro_script_memtype_t type;
+} struct_field_t;
+
+typedef struct memory_struct
+{
+    struct_field_t* fields;
+    size_t num_fields;
+    
+    // bytes spanned by the fields, from offset 0.
+    size_t size;
+} memory_struct_t;
+
+static int _lua_error(lua_State* L, const char* message)
+{
+    return luaL_error(L, "%s", message);
+}
+
+static void free_struct(memory_struct_t* layout)
+{
+    if (layout->fields)
+    {
+        for (size_t i = 0; i < layout->num_fields; ++i)
+        {
+            if (layout->fields[i].name) free(layout->fields[i].name);
+        }
+        free(layout->fields);
+    }
+    free(layout);
+}
+
+// retrieves layout from deepest elt on stack.
+// luaL_error is called on failure.
+static memory_struct_t* get_struct_from_self(lua_State* L)
+{
+    memory_struct_t** layout = (memory_struct_t**)luaL_checkudata(L, 1, STRUCT_METATABLE);
+    if (!*layout) _lua_error(L, "invalid 'self' argument (struct layout has been freed).");
+    return *layout;
+}
+
+// pushes a table with the fields of the record at data.
+static void push_record(lua_State* L, memory_struct_t const* layout, const char* data)
+{
+    lua_createtable(L, 0, layout->num_fields);
+    for (size_t i = 0; i < layout->num_fields; ++i)
+    {
+        struct_field_t const* field = &layout->fields[i];
+        uint64_t value;
+        memcpy(&value, data + field->offset, field->type.size);
+        retro_script_memtype_swap(field->type, &value, 1);
+        retro_script_memtype_push(L, field->type, &value);
+        lua_rawsetfield(L, -2, field->name);
+    }
+}
+
+// pushes the record at the given address, or returns false if it is not mapped.
+// buff must hold layout->size bytes.
+static bool read_record(lua_State* L, memory_struct_t const* layout, size_t address, char* buff)
+{
+    // (deferred writes are only seen through the memory map.)
+    const char* data = retro_script_journal_pending ? NULL : retro_script_memory_access_range(address, layout->size, NULL);
+    if (!data)
+    {
+        if (!retro_script_journal_read_bytes_in(NULL, address, buff, layout->size)) return false;
+        data = buff;
+    }
+    
+    push_record(L, layout, data);
+    return true;
+}
+
+// lua args: self, address
+//      ret: table of field values, or nil if the record is not mapped
+static int struct_read(lua_State* L)
+{
+    memory_struct_t* layout = get_struct_from_self(L);
+    if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) < 0) return _lua_error(L, "invalid address for struct read");
+    
+    char stack_buff[256];
+    char* buff = (layout->size <= sizeof(stack_buff)) ? stack_buff : malloc(layout->size);
+    if (!buff) return _lua_error(L, "unable to allocate buffer for struct read");
+    
+    const bool success = read_record(L, layout, lua_tointeger(L, 2), buff);
+    if (buff != stack_buff) free(buff);
+    return success ? 1 : 0;
+}
+
+// lua args: self, address, stride, count
+//      ret: array of tables of field values, or nil if any record is not mapped
+static int struct_read_array(lua_State* L)
+{
+    memory_struct_t* layout = get_struct_from_self(L);
+    if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) < 0) return _lua_error(L, "invalid address for struct read_array");
+    if (!lua_isinteger(L, 3) || lua_tointeger(L, 3) < 0) return _lua_error(L, "invalid stride for struct read_array");
+    if (!lua_isinteger(L, 4) || lua_tointeger(L, 4) < 0) return _lua_error(L, "invalid count for struct read_array");
+    
+    const size_t address = lua_tointeger(L, 2);
+    const size_t stride = lua_tointeger(L, 3);
+    const size_t count = lua_tointeger(L, 4);
+    if (count > 0 && stride > 0 && (count - 1) > (SIZE_MAX - address) / stride) return 0;
+    
+    char stack_buff[256];
+    char* buff = (layout->size <= sizeof(stack_buff)) ? stack_buff : malloc(layout->size);
+    if (!buff) return _lua_error(L, "unable to allocate buffer for struct read_array");
+    
+    bool success = true;
+    lua_createtable(L, count, 0);
+    for (size_t i = 0; i < count && success; ++i)
+    {
+        success = read_record(L, layout, address + i * stride, buff);
+        if (success) lua_rawseti(L, -2, i + 1);
+    }
+    
+    if (buff != stack_buff) free(buff);
+    if (!success)
+    {
+        lua_pop(L, 1);
+        return 0;
+    }
+    return 1;
+}
+
+// lua args: self, address, table
+//      ret: 1 if written, 0 if the record is not mapped or is const
+// fields missing from the table are left unchanged.
+static int struct_write(lua_State* L)
+{
+    memory_struct_t* layout = get_struct_from_self(L);
+    if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) < 0) return _lua_error(L, "invalid address for struct write");
+    if (!lua_istable(L, 3)) return _lua_error(L, "invalid values for struct write");
+    const size_t address = lua_tointeger(L, 2);
+    
+    char stack_buff[256];
+    char* buff = (layout->size <= sizeof(stack_buff)) ? stack_buff : malloc(layout->size);
+    if (!buff) return _lua_error(L, "unable to allocate buffer for struct write");
+    
+    // bytes between the fields are written back unchanged.
+    bool success = retro_script_journal_read_bytes_in(NULL, address, buff, layout->size);
+    for (size_t i = 0; i < layout->num_fields && success; ++i)
+    {
+        struct_field_t const* field = &layout->fields[i];
+        if (lua_rawgetfield(L, 3, field->name) != LUA_TNIL)
+        {
+            uint64_t value;
+            if (!retro_script_memtype_to(L, -1, field->type, &value))
+            {
+                if (buff != stack_buff) free(buff);
+                return luaL_error(L, "invalid value for field \"%s\"", field->name);
+            }
+            retro_script_memtype_swap(field->type, &value, 1);
+            memcpy(buff + field->offset, &value, field->type.size);
+        }
+        lua_pop(L, 1);
+    }
+    
+    if (success) success = retro_script_journal_write_bytes_in(NULL, address, buff, layout->size);
+    if (buff != stack_buff) free(buff);
+    
+    lua_pushinteger(L, success);
+    return 1;
+}
+
+// parses the field list at idx into the layout.
+static bool parse_fields(lua_State* L, int idx, memory_struct_t* layout)
+{
+    const size_t num_fields = lua_rawlen(L, idx);
+    if (num_fields == 0) return false;
+    
+    layout->fields = (struct_field_t*)calloc(num_fields, sizeof(struct_field_t));
+    if (!layout->fields) return false;
+    
+    for (size_t i = 0; i < num_fields; ++i)
+    {
+        struct_field_t* field = &layout->fields[i];
+        bool valid = lua_rawgeti(L, idx, i + 1) == LUA_TTABLE;
+        if (valid)
+        {
+            const int entry = lua_gettop(L);
+            lua_rawgeti(L, entry, 1);
+            lua_rawgeti(L, entry, 2);
+            lua_rawgeti(L, entry, 3);
+            valid = lua_type(L, -3) == LUA_TSTRING
+                && retro_script_memtype_parse_lua(L, -2, 0, &field->type)
+                && lua_isinteger(L, -1) && lua_tointeger(L, -1) >= 0;
+            if (valid)
+            {
+                field->offset = lua_tointeger(L, -1);
+                field->name = retro_script_strdup(lua_tostring(L, -3));
+                valid = field->name != NULL && field->offset <= SIZE_MAX - field->type.size;
+            }
+            lua_pop(L, 3);
+        }
+        lua_pop(L, 1);
+        
+        if (!valid) return false;
+        ++layout->num_fields;
+        
+        if (field->offset + field->type.size > layout->size)
+        {
+            layout->size = field->offset + field->type.size;
+        }
+    }
+    
+    return true;
+}
+
+// lua args: self, key
+// size is read from the layout; other keys are the methods (upvalue 1).
+static int struct_index(lua_State* L)
+{
+    memory_struct_t* layout = get_struct_from_self(L);
+    if (lua_isstring(L, 2) && !strcmp(lua_tostring(L, 2), "size"))
+    {
+        lua_pushinteger(L, layout->size);
+        return 1;
+    }
+    lua_settop(L, 2);
+    lua_rawget(L, lua_upvalueindex(1));
+    return 1;
+}
+
+// lua args: self
+// frees the layout once the script no longer references it.
+static int struct_gc(lua_State* L)
+{
+    memory_struct_t** layout = (memory_struct_t**)luaL_checkudata(L, 1, STRUCT_METATABLE);
+    if (*layout) free_struct(*layout);
+    *layout = NULL;
+    return 0;
+}
+
+// sets the metatable shared by all of the script's layouts (creating it if necessary) on the userdata at the top of the stack.
+static void set_struct_metatable(lua_State* L)
+{
+    if (!luaL_getsubtable(L, LUA_REGISTRYINDEX, STRUCT_METATABLE))
+    {
+        #define FUNCFIELD(name, f) lua_pushcfunction(L, f); lua_rawsetfield(L, -2, #name);
+        
+        // methods
+        lua_newtable(L);
+        FUNCFIELD(read, struct_read);
+        FUNCFIELD(read_array, struct_read_array);
+        FUNCFIELD(write, struct_write);
+        
+        lua_pushcclosure(L, struct_index, 1);
+        lua_rawsetfield(L, -2, "__index");
+        FUNCFIELD(__gc, struct_gc);
+        
+        #undef FUNCFIELD
+    }
+    lua_setmetatable(L, -2);
+}
+
+int retro_script_luafunc_memory_struct(lua_State* L)
+{
+    // validate args
+    if (!lua_istable(L, 1)) return _lua_error(L, "invalid fields for \"struct\"");
+    
+    // the userdata holds the layout, which is freed when the userdata is collected.
+    memory_struct_t** ud = (memory_struct_t**)lua_newuserdatauv(L, sizeof(memory_struct_t*), 0);
+    *ud = NULL;
+    set_struct_metatable(L);
+    
+    memory_struct_t* layout = alloc(memory_struct_t);
+    if (!layout) return _lua_error(L, "unable to allocate struct layout");
+    memset(layout, 0, sizeof(*layout));
+    *ud = layout;
+    
+    if (!parse_fields(L, 1, layout))
+    {
+        return _lua_error(L, "invalid fields for \"struct\" (expected { { name, type, offset }, ... })");
+    }
+    
+    return 1;
+}
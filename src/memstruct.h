@@ -0,0 +1,11 @@
+#pragma once
+
+/* record layouts compiled from a lua field list, so that whole records can be
+ * decoded from / encoded to emulated memory in a single call.
+ */
+
+#include "script.h"
+
+// lua args: { { name, type, offset }, ... }
+//      ret: layout (a userdata)
+int retro_script_luafunc_memory_struct(struct lua_State* L);
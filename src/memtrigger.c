@@ -0,0 +1,380 @@
+#include "l.h"
+#include "memtrigger.h"
+#include "memmap.h"
+#include "memtype.h"
+#include "script_list.h"
+#include "util.h"
+
+#include <stdint.h>
+
+typedef enum
+{
+    TRIGGER_CHANGE,
+    TRIGGER_EQ,
+    TRIGGER_NE,
+    TRIGGER_LT,
+    TRIGGER_GT,
+    TRIGGER_LE,
+    TRIGGER_GE,
+} trigger_op;
+
+typedef struct memory_trigger
+{
+    lua_Integer handle;
+    retro_script_id_t script;
+    size_t address;
+    retro_script_memtype_t type;
+    uint8_t op; // trigger_op
+    
+    // for conditions, the value compared against, in host byte order.
+    uint8_t value[8];
+    
+    // the value after the previous frame, in memory byte order.
+    uint8_t previous[8];
+    bool previous_valid;
+    
+    // whether the condition held after the previous frame (conditions only fire when it becomes true).
+    bool condition;
+    
+    // NULL if the value does not lie contiguously in host memory; it is then read through the memory map.
+    const char* host;
+    
+    // registry reference to the callback.
+    int ref;
+} memory_trigger_t;
+
+// a trigger which fired during the current frame, recorded before any lua is called
+// (as callbacks may add or remove triggers).
+typedef struct trigger_fired
+{
+    lua_Integer handle;
+    uint8_t current[8];
+    uint8_t previous[8];
+} trigger_fired_t;
+
+// sorted by handle.
+static memory_trigger_t* triggers = NULL;
+static size_t num_triggers = 0;
+static size_t triggers_capacity = 0;
+static lua_Integer next_handle = 1;
+
+// reused between frames.
+static trigger_fired_t* fired = NULL;
+static size_t fired_capacity = 0;
+
+// memory map generation the host pointers were resolved for.
+static uint32_t triggers_generation = 0;
+
+static int _lua_error(lua_State* L, const char* message)
+{
+    return luaL_error(L, "%s", message);
+}
+
+static bool parse_op(const char* s, uint8_t* out)
+{
+    if (!strcmp(s, "==")) *out = TRIGGER_EQ;
+    else if (!strcmp(s, "~=") || !strcmp(s, "!=")) *out = TRIGGER_NE;
+    else if (!strcmp(s, "<")) *out = TRIGGER_LT;
+    else if (!strcmp(s, ">")) *out = TRIGGER_GT;
+    else if (!strcmp(s, "<=")) *out = TRIGGER_LE;
+    else if (!strcmp(s, ">=")) *out = TRIGGER_GE;
+    else return false;
+    return true;
+}
+
+static void trigger_resolve(memory_trigger_t* trigger)
+{
+    trigger->host = retro_script_memory_access_range(trigger->address, trigger->type.size, NULL);
+}
+
+// reads the trigger's value into out (in memory byte order).
+static bool trigger_read(memory_trigger_t const* trigger, uint8_t* out)
+{
+    if (trigger->host)
+    {
+        memcpy(out, trigger->host, trigger->type.size);
+        return true;
+    }
+    return retro_script_memory_read_bytes(trigger->address, out, trigger->type.size);
+}
+
+// compares the current value (in memory byte order) against the trigger's value.
+static bool trigger_test(memory_trigger_t const* trigger, const uint8_t* current)
+{
+    uint8_t data[8];
+    memcpy(data, current, trigger->type.size);
+    retro_script_memtype_swap(trigger->type, data, 1);
+    
+    #define TEST(ctype) { \
+        ctype x, y; \
+        memcpy(&x, data, sizeof(x)); \
+        memcpy(&y, trigger->value, sizeof(y)); \
+        switch (trigger->op) \
+        { \
+        case TRIGGER_EQ: return x == y; \
+        case TRIGGER_NE: return x != y; \
+        case TRIGGER_LT: return x < y; \
+        case TRIGGER_GT: return x > y; \
+        case TRIGGER_LE: return x <= y; \
+        case TRIGGER_GE: return x >= y; \
+        } \
+        return false; \
+    }
+    switch (trigger->type.kind)
+    {
+    case RETRO_SCRIPT_MEMTYPE_INT:
+        switch (trigger->type.size)
+        {
+        case 1: TEST(int8_t);
+        case 2: TEST(int16_t);
+        case 4: TEST(int32_t);
+        case 8: TEST(int64_t);
+        }
+        break;
+    case RETRO_SCRIPT_MEMTYPE_UINT:
+        switch (trigger->type.size)
+        {
+        case 1: TEST(uint8_t);
+        case 2: TEST(uint16_t);
+        case 4: TEST(uint32_t);
+        case 8: TEST(uint64_t);
+        }
+        break;
+    case RETRO_SCRIPT_MEMTYPE_FLOAT:
+        switch (trigger->type.size)
+        {
+        case 4: TEST(float);
+        case 8: TEST(double);
+        }
+        break;
+    }
+    #undef TEST
+    
+    return false;
+}
+
+static memory_trigger_t* trigger_find(lua_Integer handle)
+{
+    size_t lo = 0, hi = num_triggers;
+    while (lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (triggers[mid].handle < handle)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return (lo < num_triggers && triggers[lo].handle == handle) ? &triggers[lo] : NULL;
+}
+
+static void push_value(lua_State* L, retro_script_memtype_t type, const uint8_t* data)
+{
+    uint8_t value[8];
+    memcpy(value, data, type.size);
+    retro_script_memtype_swap(type, value, 1);
+    retro_script_memtype_push(L, type, value);
+}
+
+void retro_script_memory_triggers_after_run()
+{
+    if (num_triggers == 0) return;
+    
+    const uint32_t generation = retro_script_memory_map_generation();
+    if (generation != triggers_generation)
+    {
+        for (size_t i = 0; i < num_triggers; ++i)
+        {
+            trigger_resolve(&triggers[i]);
+        }
+        triggers_generation = generation;
+    }
+    
+    // evaluate every trigger without entering lua.
+    size_t num_fired = 0;
+    for (size_t i = 0; i < num_triggers; ++i)
+    {
+        memory_trigger_t* trigger = &triggers[i];
+        uint8_t current[8];
+        if (!trigger_read(trigger, current)) continue;
+        
+        bool fire;
+        if (trigger->op == TRIGGER_CHANGE)
+        {
+            fire = trigger->previous_valid && memcmp(current, trigger->previous, trigger->type.size) != 0;
+        }
+        else
+        {
+            const bool condition = trigger_test(trigger, current);
+            fire = condition && !trigger->condition;
+            trigger->condition = condition;
+        }
+        
+        if (fire)
+        {
+            if (num_fired >= fired_capacity)
+            {
+                const size_t capacity = fired_capacity ? 2 * fired_capacity : 16;
+                trigger_fired_t* resized = (trigger_fired_t*)realloc(fired, sizeof(trigger_fired_t) * capacity);
+                if (!resized) break;
+                fired = resized;
+                fired_capacity = capacity;
+            }
+            
+            trigger_fired_t* f = &fired[num_fired++];
+            f->handle = trigger->handle;
+            memcpy(f->current, current, trigger->type.size);
+            memcpy(f->previous, trigger->previous, trigger->type.size);
+        }
+        
+        memcpy(trigger->previous, current, trigger->type.size);
+        trigger->previous_valid = true;
+    }
+    
+    // call back, in the order the triggers were set.
+    for (size_t i = 0; i < num_fired; ++i)
+    {
+        // (an earlier callback may have removed this trigger.)
+        memory_trigger_t const* trigger = trigger_find(fired[i].handle);
+        if (!trigger) continue;
+        script_state_t* script = script_find(trigger->script);
+        if (!script) continue;
+        
+        lua_State* L = script->L;
+        const bool change = trigger->op == TRIGGER_CHANGE;
+        push_value(L, trigger->type, fired[i].current);
+        if (change)
+        {
+            push_value(L, trigger->type, fired[i].previous);
+        }
+        lua_rawgeti(L, LUA_REGISTRYINDEX, trigger->ref);
+        
+        const int result = retro_script_lua_pcall(L, change ? 2 : 1, 0);
+        if (result != LUA_OK)
+        {
+            retro_script_on_uncaught_error(L, result);
+        }
+        lua_settop(L, 0);
+    }
+}
+
+// adds a trigger with the given address, type, and op (and value, for conditions) to the current script.
+// the callback is taken from the top of the stack.
+static int add_trigger(lua_State* L, memory_trigger_t* trigger)
+{
+    script_state_t* script = script_find_lua(L);
+    if (!script) return _lua_error(L, "invalid lua context");
+    
+    if (num_triggers >= triggers_capacity)
+    {
+        const size_t capacity = triggers_capacity ? 2 * triggers_capacity : 16;
+        memory_trigger_t* resized = (memory_trigger_t*)realloc(triggers, sizeof(memory_trigger_t) * capacity);
+        if (!resized) return _lua_error(L, "unable to allocate trigger");
+        triggers = resized;
+        triggers_capacity = capacity;
+    }
+    
+    trigger->handle = next_handle++;
+    trigger->script = script->id;
+    trigger->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    trigger_resolve(trigger);
+    
+    // the value when the trigger is set counts as the previous value, so a condition
+    // which already holds only fires once it has stopped holding and then holds again.
+    if (trigger_read(trigger, trigger->previous))
+    {
+        trigger->previous_valid = true;
+        if (trigger->op != TRIGGER_CHANGE) trigger->condition = trigger_test(trigger, trigger->previous);
+    }
+    
+    // (handles increase, so appending keeps the triggers sorted.)
+    triggers[num_triggers++] = *trigger;
+    
+    lua_pushinteger(L, trigger->handle);
+    return 1;
+}
+
+int retro_script_luafunc_on_change(lua_State* L)
+{
+    // validate args
+    memory_trigger_t trigger;
+    memset(&trigger, 0, sizeof(trigger));
+    if (!lua_isinteger(L, 1) || lua_tointeger(L, 1) < 0) return _lua_error(L, "invalid address for \"on_change\"");
+    if (!retro_script_memtype_parse_lua(L, 2, 0, &trigger.type)) return _lua_error(L, "invalid type for \"on_change\"");
+    if (!lua_isfunction(L, 3)) return _lua_error(L, "invalid callback for \"on_change\"");
+    
+    trigger.address = lua_tointeger(L, 1);
+    trigger.op = TRIGGER_CHANGE;
+    
+    lua_settop(L, 3);
+    return add_trigger(L, &trigger);
+}
+
+int retro_script_luafunc_on_value(lua_State* L)
+{
+    // validate args
+    memory_trigger_t trigger;
+    memset(&trigger, 0, sizeof(trigger));
+    if (!lua_isinteger(L, 1) || lua_tointeger(L, 1) < 0) return _lua_error(L, "invalid address for \"on_value\"");
+    if (!retro_script_memtype_parse_lua(L, 2, 0, &trigger.type)) return _lua_error(L, "invalid type for \"on_value\"");
+    if (!lua_isstring(L, 3) || !parse_op(lua_tostring(L, 3), &trigger.op)) return _lua_error(L, "invalid comparison for \"on_value\"");
+    if (!retro_script_memtype_to(L, 4, trigger.type, trigger.value)) return _lua_error(L, "invalid value for \"on_value\"");
+    if (!lua_isfunction(L, 5)) return _lua_error(L, "invalid callback for \"on_value\"");
+    
+    trigger.address = lua_tointeger(L, 1);
+    
+    lua_settop(L, 5);
+    return add_trigger(L, &trigger);
+}
+
+int retro_script_luafunc_remove_trigger(lua_State* L)
+{
+    if (!lua_isinteger(L, 1)) return _lua_error(L, "invalid handle for \"remove_trigger\"");
+    script_state_t* script = script_find_lua(L);
+    if (!script) return _lua_error(L, "invalid lua context");
+    
+    // (scripts may only remove their own triggers.)
+    memory_trigger_t* trigger = trigger_find(lua_tointeger(L, 1));
+    if (!trigger || trigger->script != script->id)
+    {
+        lua_pushinteger(L, 0);
+        return 1;
+    }
+    
+    luaL_unref(L, LUA_REGISTRYINDEX, trigger->ref);
+    const size_t i = trigger - triggers;
+    memmove(&triggers[i], &triggers[i + 1], sizeof(memory_trigger_t) * (num_triggers - i - 1));
+    --num_triggers;
+    
+    lua_pushinteger(L, 1);
+    return 1;
+}
+
+void retro_script_free_triggers(script_state_t* script)
+{
+    if (!script) return;
+    
+    // (the callbacks' references are released when the lua state is closed.)
+    size_t kept = 0;
+    for (size_t i = 0; i < num_triggers; ++i)
+    {
+        if (triggers[i].script != script->id)
+        {
+            triggers[kept++] = triggers[i];
+        }
+    }
+    num_triggers = kept;
+    
+    if (num_triggers == 0)
+    {
+        if (triggers) free(triggers);
+        if (fired) free(fired);
+        triggers = NULL;
+        fired = NULL;
+        triggers_capacity = 0;
+        fired_capacity = 0;
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+/* callbacks on values in emulated memory, with their conditions checked in C after each frame,
+ * so that lua is only entered when a condition fires.
+ */
+
+#include "script.h"
+
+// checks every trigger, and calls back those which fired. Called after the core runs a frame.
+void retro_script_memory_triggers_after_run();
+
+// lua args: address, type, callback
+//      ret: trigger handle
+int retro_script_luafunc_on_change(struct lua_State* L);
+
+// lua args: address, type, op, value, callback
+//      ret: trigger handle
+int retro_script_luafunc_on_value(struct lua_State* L);
+
+// lua args: trigger handle
+//      ret: 1 if removed, 0 if there was no such trigger
+int retro_script_luafunc_remove_trigger(struct lua_State* L);
+
+// removes all triggers set by the given script.
+void retro_script_free_triggers(script_state_t*);
@@ -0,0 +1,144 @@
+#include "l.h"
+#include "memtype.h"
+#include "bswap.h"
+
+#include <string.h>
+
+static const struct
+{
+    const char* name;
+    uint8_t size;
+    uint8_t kind;
+} memtypes[] = {
+    { "char", 1, RETRO_SCRIPT_MEMTYPE_INT },
+    { "byte", 1, RETRO_SCRIPT_MEMTYPE_UINT },
+    { "int8", 1, RETRO_SCRIPT_MEMTYPE_INT },
+    { "uint8", 1, RETRO_SCRIPT_MEMTYPE_UINT },
+    { "int16", 2, RETRO_SCRIPT_MEMTYPE_INT },
+    { "uint16", 2, RETRO_SCRIPT_MEMTYPE_UINT },
+    { "int32", 4, RETRO_SCRIPT_MEMTYPE_INT },
+    { "uint32", 4, RETRO_SCRIPT_MEMTYPE_UINT },
+    { "int64", 8, RETRO_SCRIPT_MEMTYPE_INT },
+    { "uint64", 8, RETRO_SCRIPT_MEMTYPE_UINT },
+    { "float32", 4, RETRO_SCRIPT_MEMTYPE_FLOAT },
+    { "float64", 8, RETRO_SCRIPT_MEMTYPE_FLOAT },
+};
+
+bool retro_script_memtype_parse(const char* name, const char* endian, retro_script_memtype_t* out)
+{
+    if (!name) return false;
+    
+    size_t len = strlen(name);
+    bool big_endian = false;
+    
+    // suffix takes precedence over endian argument.
+    if (len > 3 && (strcmp(name + len - 3, "_le") == 0 || strcmp(name + len - 3, "_be") == 0))
+    {
+        big_endian = name[len - 2] == 'b';
+        len -= 3;
+    }
+    else if (endian)
+    {
+        if (strcmp(endian, "be") == 0) big_endian = true;
+        else if (strcmp(endian, "le") != 0) return false;
+    }
+    
+    for (size_t i = 0; i < sizeof(memtypes) / sizeof(memtypes[0]); ++i)
+    {
+        if (strlen(memtypes[i].name) == len && strncmp(memtypes[i].name, name, len) == 0)
+        {
+            out->size = memtypes[i].size;
+            out->kind = memtypes[i].kind;
+            out->big_endian = big_endian;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+bool retro_script_memtype_parse_lua(lua_State* L, int name_idx, int endian_idx, retro_script_memtype_t* out)
+{
+    if (!lua_isstring(L, name_idx)) return false;
+    
+    const char* endian = NULL;
+    if (endian_idx != 0 && !lua_isnil(L, endian_idx) && lua_type(L, endian_idx) != LUA_TNONE)
+    {
+        if (!lua_isstring(L, endian_idx)) return false;
+        endian = lua_tostring(L, endian_idx);
+    }
+    
+    return retro_script_memtype_parse(lua_tostring(L, name_idx), endian, out);
+}
+
+void retro_script_memtype_swap(retro_script_memtype_t type, void* data, size_t count)
+{
+    if (type.size > 1 && type.big_endian != SYS_IS_BIGENDIAN)
+    {
+        retro_script_bswap_array(data, type.size, count);
+    }
+}
+
+void retro_script_memtype_push(lua_State* L, retro_script_memtype_t type, const void* data)
+{
+    #define PUSH(ctype, luatype) { ctype v; memcpy(&v, data, sizeof(v)); lua_push##luatype(L, v); return; }
+    switch (type.kind)
+    {
+    case RETRO_SCRIPT_MEMTYPE_INT:
+        switch (type.size)
+        {
+        case 1: PUSH(int8_t, integer);
+        case 2: PUSH(int16_t, integer);
+        case 4: PUSH(int32_t, integer);
+        case 8: PUSH(int64_t, integer);
+        }
+        break;
+    case RETRO_SCRIPT_MEMTYPE_UINT:
+        switch (type.size)
+        {
+        case 1: PUSH(uint8_t, integer);
+        case 2: PUSH(uint16_t, integer);
+        case 4: PUSH(uint32_t, integer);
+        case 8: PUSH(uint64_t, integer);
+        }
+        break;
+    case RETRO_SCRIPT_MEMTYPE_FLOAT:
+        switch (type.size)
+        {
+        case 4: PUSH(float, number);
+        case 8: PUSH(double, number);
+        }
+        break;
+    }
+    #undef PUSH
+    
+    lua_pushnil(L);
+}
+
+bool retro_script_memtype_to(lua_State* L, int idx, retro_script_memtype_t type, void* data)
+{
+    #define STORE(ctype, luatype) { ctype v = (ctype)lua_to##luatype(L, idx); memcpy(data, &v, sizeof(v)); return true; }
+    if (type.kind == RETRO_SCRIPT_MEMTYPE_FLOAT)
+    {
+        if (!lua_isnumber(L, idx)) return false;
+        switch (type.size)
+        {
+        case 4: STORE(float, number);
+        case 8: STORE(double, number);
+        }
+    }
+    else
+    {
+        if (!lua_isinteger(L, idx)) return false;
+        switch (type.size)
+        {
+        case 1: STORE(uint8_t, integer);
+        case 2: STORE(uint16_t, integer);
+        case 4: STORE(uint32_t, integer);
+        case 8: STORE(uint64_t, integer);
+        }
+    }
+    #undef STORE
+    
+    return false;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+/* scalar value types which can be read from / written to emulated memory,
+ * as named in the lua api (e.g. "uint16_be", or "float32" with endianness "le").
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct lua_State;
+
+typedef enum
+{
+    RETRO_SCRIPT_MEMTYPE_INT,
+    RETRO_SCRIPT_MEMTYPE_UINT,
+    RETRO_SCRIPT_MEMTYPE_FLOAT,
+} retro_script_memtype_kind;
+
+typedef struct retro_script_memtype
+{
+    uint8_t size; // in bytes: 1, 2, 4, or 8.
+    uint8_t kind; // retro_script_memtype_kind
+    bool big_endian;
+} retro_script_memtype_t;
+
+// parses a type name like "byte", "int16", or "uint32_be".
+// endian may be NULL, "le", or "be"; it applies if the name has no _le/_be suffix (default: little-endian).
+// returns false if invalid.
+bool retro_script_memtype_parse(const char* name, const char* endian, retro_script_memtype_t* out);
+
+// as retro_script_memtype_parse, with arguments taken from the lua stack.
+// endian_idx may be 0 (no endianness argument); a missing or nil endianness argument is allowed.
+bool retro_script_memtype_parse_lua(struct lua_State* L, int name_idx, int endian_idx, retro_script_memtype_t* out);
+
+// converts count consecutive values between memory byte order and host byte order, in place.
+void retro_script_memtype_swap(retro_script_memtype_t type, void* data, size_t count);
+
+// pushes the (host byte order) value at data onto the lua stack.
+void retro_script_memtype_push(struct lua_State* L, retro_script_memtype_t type, const void* data);
+
+// stores the lua value at idx into data, in host byte order.
+// returns false if the lua value is not a number.
+bool retro_script_memtype_to(struct lua_State* L, int idx, retro_script_memtype_t type, void* data);
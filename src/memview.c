@@ -0,0 +1,303 @@
+#include "l.h"
+#include "memview.h"
+#include "memmap.h"
+#include "memjournal.h"
+#include "memtype.h"
+#include "util.h"
+
+#include <stdint.h>
+
+// registry name of the metatable shared by all views.
+#define VIEW_METATABLE "retro_script_memory_view"
+
+// a fixed range of emulated memory, with the host pointer cached while the memory map is unchanged.
+typedef struct memory_view
+{
+    size_t address;
+    size_t size;
+    
+    // NULL if the range is not contiguous in host memory; access then goes through the memory map.
+    char* host;
+    bool is_const;
+    
+    // memory map generation host was resolved for.
+    uint32_t generation;
+} memory_view_t;
+
+static int _lua_error(lua_State* L, const char* message)
+{
+    return luaL_error(L, "%s", message);
+}
+
+static void view_resolve(memory_view_t* view)
+{
+    view->is_const = false;
+    view->host = retro_script_memory_access_range(view->address, view->size, &view->is_const);
+    view->generation = retro_script_memory_map_generation();
+}
+
+static FORCEINLINE char* view_host(memory_view_t* view)
+{
+    if (view->generation != retro_script_memory_map_generation())
+    {
+        view_resolve(view);
+    }
+    return view->host;
+}
+
+// retrieves view from deepest elt on stack.
+// luaL_error is called on failure.
+static memory_view_t* get_view_from_self(lua_State* L)
+{
+    return (memory_view_t*)luaL_checkudata(L, 1, VIEW_METATABLE);
+}
+
+// retrieves offset argument, checking that count bytes from there lie within the view.
+static bool get_offset(lua_State* L, memory_view_t* view, int idx, size_t count, size_t* offset)
+{
+    if (!lua_isinteger(L, idx)) return false;
+    lua_Integer v = lua_tointeger(L, idx);
+    if (v < 0 || (size_t)v > view->size || view->size - (size_t)v < count) return false;
+    *offset = (size_t)v;
+    return true;
+}
+
+static bool view_read(memory_view_t* view, size_t offset, void* out, size_t count)
+{
+    char* host = view_host(view);
+    if (host)
+    {
+        memcpy(out, host + offset, count);
+        return true;
+    }
+    return retro_script_memory_read_bytes(view->address + offset, out, count);
+}
+
+static bool view_write(memory_view_t* view, size_t offset, const void* in, size_t count)
+{
+    char* host = view_host(view);
+    if (host)
+    {
+        if (view->is_const) return false;
+        retro_script_journal_forget(host + offset, count);
+        memcpy(host + offset, in, count);
+        return true;
+    }
+    return retro_script_journal_write_now_in(NULL, view->address + offset, in, count);
+}
+
+// lua args: self, offset
+static int view_read_type(lua_State* L, retro_script_memtype_t type)
+{
+    memory_view_t* view = get_view_from_self(L);
+    
+    size_t offset;
+    if (!get_offset(L, view, 2, type.size, &offset)) return _lua_error(L, "offset out of bounds for memory view");
+    
+    uint64_t data;
+    if (!view_read(view, offset, &data, type.size)) return 0;
+    
+    retro_script_memtype_swap(type, &data, 1);
+    retro_script_memtype_push(L, type, &data);
+    return 1;
+}
+
+// lua args: self, offset, value
+static int view_write_type(lua_State* L, retro_script_memtype_t type)
+{
+    memory_view_t* view = get_view_from_self(L);
+    
+    size_t offset;
+    if (!get_offset(L, view, 2, type.size, &offset)) return _lua_error(L, "offset out of bounds for memory view");
+    
+    uint64_t data;
+    if (!retro_script_memtype_to(L, 3, type, &data)) return 0;
+    retro_script_memtype_swap(type, &data, 1);
+    
+    lua_pushinteger(L, view_write(view, offset, &data, type.size));
+    return 1;
+}
+
+#define DEFINE_VIEW_ACCESS(name, size, kind, big_endian) \
+static int view_read_##name(lua_State* L) \
+{ \
+    const retro_script_memtype_t type = { size, RETRO_SCRIPT_MEMTYPE_##kind, big_endian }; \
+    return view_read_type(L, type); \
+} \
+static int view_write_##name(lua_State* L) \
+{ \
+    const retro_script_memtype_t type = { size, RETRO_SCRIPT_MEMTYPE_##kind, big_endian }; \
+    return view_write_type(L, type); \
+}
+
+#define DEFINE_VIEW_ACCESS_ENDIAN(name, size, kind) \
+    DEFINE_VIEW_ACCESS(name##_le, size, kind, false) \
+    DEFINE_VIEW_ACCESS(name##_be, size, kind, true)
+
+DEFINE_VIEW_ACCESS(char, 1, INT, false)
+DEFINE_VIEW_ACCESS(byte, 1, UINT, false)
+DEFINE_VIEW_ACCESS_ENDIAN(int16, 2, INT)
+DEFINE_VIEW_ACCESS_ENDIAN(uint16, 2, UINT)
+DEFINE_VIEW_ACCESS_ENDIAN(int32, 4, INT)
+DEFINE_VIEW_ACCESS_ENDIAN(uint32, 4, UINT)
+DEFINE_VIEW_ACCESS_ENDIAN(int64, 8, INT)
+DEFINE_VIEW_ACCESS_ENDIAN(uint64, 8, UINT)
+DEFINE_VIEW_ACCESS_ENDIAN(float32, 4, FLOAT)
+DEFINE_VIEW_ACCESS_ENDIAN(float64, 8, FLOAT)
+
+// lua args: self, offset, length
+//      ret: string
+static int view_read_bytes(lua_State* L)
+{
+    memory_view_t* view = get_view_from_self(L);
+    if (!lua_isinteger(L, 3) || lua_tointeger(L, 3) < 0) return _lua_error(L, "invalid length for memory view");
+    
+    const size_t count = lua_tointeger(L, 3);
+    size_t offset;
+    if (!get_offset(L, view, 2, count, &offset)) return _lua_error(L, "offset out of bounds for memory view");
+    
+    char* host = view_host(view);
+    if (host)
+    {
+        lua_pushlstring(L, host + offset, count);
+        return 1;
+    }
+    
+    char* buff = malloc(count ? count : 1);
+    if (!buff) return _lua_error(L, "unable to allocate buffer for memory view");
+    const bool success = retro_script_memory_read_bytes(view->address + offset, buff, count);
+    if (success) lua_pushlstring(L, buff, count);
+    free(buff);
+    return success ? 1 : 0;
+}
+
+// lua args: self, offset, string
+//      ret: 1 if written
+static int view_write_bytes(lua_State* L)
+{
+    memory_view_t* view = get_view_from_self(L);
+    if (!lua_isstring(L, 3)) return 0;
+    
+    size_t count;
+    const char* data = lua_tolstring(L, 3, &count);
+    size_t offset;
+    if (!get_offset(L, view, 2, count, &offset)) return _lua_error(L, "offset out of bounds for memory view");
+    
+    lua_pushinteger(L, view_write(view, offset, data, count));
+    return 1;
+}
+
+// lua args: self, key
+// integer keys read a byte (nil if out of bounds or unmapped); other keys are the fields and methods (upvalue 1).
+static int view_index(lua_State* L)
+{
+    memory_view_t* view = get_view_from_self(L);
+    if (!lua_isinteger(L, 2))
+    {
+        if (lua_isstring(L, 2) && !strcmp(lua_tostring(L, 2), "address"))
+        {
+            lua_pushinteger(L, view->address);
+            return 1;
+        }
+        if (lua_isstring(L, 2) && !strcmp(lua_tostring(L, 2), "size"))
+        {
+            lua_pushinteger(L, view->size);
+            return 1;
+        }
+        lua_settop(L, 2);
+        lua_rawget(L, lua_upvalueindex(1));
+        return 1;
+    }
+    
+    size_t offset;
+    uint8_t data;
+    if (!get_offset(L, view, 2, 1, &offset) || !view_read(view, offset, &data, 1)) return 0;
+    
+    lua_pushinteger(L, data);
+    return 1;
+}
+
+// lua args: self, key, value
+static int view_newindex(lua_State* L)
+{
+    memory_view_t* view = get_view_from_self(L);
+    size_t offset;
+    if (!lua_isinteger(L, 2)) return _lua_error(L, "memory view fields cannot be assigned");
+    if (!get_offset(L, view, 2, 1, &offset)) return _lua_error(L, "offset out of bounds for memory view");
+    if (!lua_isinteger(L, 3)) return _lua_error(L, "invalid value for memory view");
+    
+    const uint8_t data = (uint8_t)lua_tointeger(L, 3);
+    view_write(view, offset, &data, 1);
+    return 0;
+}
+
+// lua args: self
+static int view_len(lua_State* L)
+{
+    memory_view_t* view = get_view_from_self(L);
+    lua_pushinteger(L, view->size);
+    return 1;
+}
+
+// sets the metatable shared by all of the script's views (creating it if necessary) on the userdata at the top of the stack.
+static void set_view_metatable(lua_State* L)
+{
+    if (!luaL_getsubtable(L, LUA_REGISTRYINDEX, VIEW_METATABLE))
+    {
+        // methods
+        lua_newtable(L);
+        
+        #define FUNCFIELD(name, f) lua_pushcfunction(L, f); lua_rawsetfield(L, -2, #name);
+        #define VIEWFIELD(name) \
+            FUNCFIELD(read_##name, view_read_##name); \
+            FUNCFIELD(write_##name, view_write_##name);
+        #define VIEWFIELD_ENDIAN(name) \
+            VIEWFIELD(name##_le); \
+            VIEWFIELD(name##_be);
+        
+        FUNCFIELD(peek, view_read_byte);
+        FUNCFIELD(poke, view_write_byte);
+        FUNCFIELD(read_bytes, view_read_bytes);
+        FUNCFIELD(write_bytes, view_write_bytes);
+        VIEWFIELD(char);
+        VIEWFIELD(byte);
+        VIEWFIELD_ENDIAN(int16);
+        VIEWFIELD_ENDIAN(uint16);
+        VIEWFIELD_ENDIAN(int32);
+        VIEWFIELD_ENDIAN(uint32);
+        VIEWFIELD_ENDIAN(int64);
+        VIEWFIELD_ENDIAN(uint64);
+        VIEWFIELD_ENDIAN(float32);
+        VIEWFIELD_ENDIAN(float64);
+        
+        #undef VIEWFIELD_ENDIAN
+        #undef VIEWFIELD
+        
+        lua_pushcclosure(L, view_index, 1);
+        lua_rawsetfield(L, -2, "__index");
+        FUNCFIELD(__newindex, view_newindex);
+        FUNCFIELD(__len, view_len);
+        
+        #undef FUNCFIELD
+    }
+    lua_setmetatable(L, -2);
+}
+
+int retro_script_luafunc_memory_view(lua_State* L)
+{
+    // validate args
+    if (lua_gettop(L) < 2 || !lua_isinteger(L, 1) || !lua_isinteger(L, 2)) return _lua_error(L, "invalid arguments to \"view\"");
+    lua_Integer address = lua_tointeger(L, 1);
+    lua_Integer size = lua_tointeger(L, 2);
+    if (address < 0 || size <= 0) return _lua_error(L, "invalid arguments to \"view\"");
+    
+    // the view is owned by lua, and needs nothing freed with it.
+    memory_view_t* view = (memory_view_t*)lua_newuserdatauv(L, sizeof(memory_view_t), 0);
+    memset(view, 0, sizeof(*view));
+    view->address = address;
+    view->size = size;
+    view_resolve(view);
+    
+    set_view_metatable(L);
+    return 1;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "script.h"
+
+// lua args: address, size
+//      ret: view (a userdata, which need not be mapped yet)
+int retro_script_luafunc_memory_view(struct lua_State* L);
@@ -0,0 +1,624 @@
+#include "l.h"
+#include "ramsearch.h"
+#include "memmap.h"
+#include "memtype.h"
+#include "util.h"
+
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define RAMSEARCH_SSE2
+    #include <emmintrin.h>
+#endif
+
+// registry name of the metatable shared by all searches.
+#define SEARCH_METATABLE "retro_script_memory_search"
+
+// one bitmap word of candidates is compared at a time.
+#define BLOCK_ELEMENTS 64
+
+// unmapped regions are narrowed down in chunks of this size.
+#define READ_CHUNK_SIZE 0x1000
+
+// a value scan over a fixed range of emulated memory.
+// candidate i is the value at address + i * step; surviving candidates are tracked in a bitmap.
+typedef struct ram_search
+{
+    retro_script_memtype_t type;
+    size_t address;
+    size_t size;
+    size_t step;
+    
+    size_t count;
+    size_t num_words;
+    uint64_t* candidates;
+    size_t remaining;
+    
+    // raw bytes of the range, as of the latest snapshot.
+    char* raw;
+    
+    // candidate values in host byte order, padded to a whole number of blocks.
+    char* current;
+    char* previous;
+    char* scratch;
+} ram_search_t;
+
+typedef enum
+{
+    SEARCH_EQ,
+    SEARCH_NE,
+    SEARCH_LT,
+    SEARCH_GT,
+    SEARCH_LE,
+    SEARCH_GE,
+    SEARCH_DELTA,
+} search_op;
+
+static const struct
+{
+    const char* name;
+    search_op op;
+    
+    // compares against the previous snapshot only; a value may not be given.
+    bool relative;
+} search_ops[] = {
+    { "eq", SEARCH_EQ, false },
+    { "ne", SEARCH_NE, false },
+    { "lt", SEARCH_LT, false },
+    { "gt", SEARCH_GT, false },
+    { "le", SEARCH_LE, false },
+    { "ge", SEARCH_GE, false },
+    { "delta", SEARCH_DELTA, false },
+    { "changed", SEARCH_NE, true },
+    { "unchanged", SEARCH_EQ, true },
+    { "increased", SEARCH_GT, true },
+    { "decreased", SEARCH_LT, true },
+};
+
+static int _lua_error(lua_State* L, const char* message)
+{
+    return luaL_error(L, "%s", message);
+}
+
+#ifdef RAMSEARCH_SSE2
+// compares 16 integer lanes of a against b.
+// lanes are biased so that unsigned values compare correctly with the signed instructions,
+// then narrowed to one byte each for movemask.
+static FORCEINLINE void compare_lanes_epi(const char* a, const char* b, unsigned size, __m128i bias, uint64_t* eq, uint64_t* gt, uint64_t* lt)
+{
+    __m128i e[4], g[4], l[4];
+    for (unsigned v = 0; v < size; ++v)
+    {
+        const __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + 16 * v)), bias);
+        const __m128i y = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(b + 16 * v)), bias);
+        switch (size)
+        {
+        case 1:
+            e[v] = _mm_cmpeq_epi8(x, y);
+            g[v] = _mm_cmpgt_epi8(x, y);
+            l[v] = _mm_cmplt_epi8(x, y);
+            break;
+        case 2:
+            e[v] = _mm_cmpeq_epi16(x, y);
+            g[v] = _mm_cmpgt_epi16(x, y);
+            l[v] = _mm_cmplt_epi16(x, y);
+            break;
+        case 4:
+            e[v] = _mm_cmpeq_epi32(x, y);
+            g[v] = _mm_cmpgt_epi32(x, y);
+            l[v] = _mm_cmplt_epi32(x, y);
+            break;
+        }
+    }
+    
+    switch (size)
+    {
+    case 2:
+        e[0] = _mm_packs_epi16(e[0], e[1]);
+        g[0] = _mm_packs_epi16(g[0], g[1]);
+        l[0] = _mm_packs_epi16(l[0], l[1]);
+        break;
+    case 4:
+        e[0] = _mm_packs_epi16(_mm_packs_epi32(e[0], e[1]), _mm_packs_epi32(e[2], e[3]));
+        g[0] = _mm_packs_epi16(_mm_packs_epi32(g[0], g[1]), _mm_packs_epi32(g[2], g[3]));
+        l[0] = _mm_packs_epi16(_mm_packs_epi32(l[0], l[1]), _mm_packs_epi32(l[2], l[3]));
+        break;
+    }
+    
+    *eq = (uint16_t)_mm_movemask_epi8(e[0]);
+    *gt = (uint16_t)_mm_movemask_epi8(g[0]);
+    *lt = (uint16_t)_mm_movemask_epi8(l[0]);
+}
+
+static FORCEINLINE void compare_block_epi(const char* a, const char* b, unsigned size, __m128i bias, uint64_t* eq, uint64_t* gt, uint64_t* lt)
+{
+    for (unsigned i = 0; i < BLOCK_ELEMENTS; i += 16)
+    {
+        uint64_t e, g, l;
+        compare_lanes_epi(a + i * size, b + i * size, size, bias, &e, &g, &l);
+        *eq |= e << i;
+        *gt |= g << i;
+        *lt |= l << i;
+    }
+}
+#endif
+
+// compares a block of values a against b, setting bit k of each result for element k.
+static void compare_block(retro_script_memtype_t type, const char* a, const char* b, uint64_t* eq, uint64_t* gt, uint64_t* lt)
+{
+    *eq = 0;
+    *gt = 0;
+    *lt = 0;
+    
+    #ifdef RAMSEARCH_SSE2
+    if (type.kind == RETRO_SCRIPT_MEMTYPE_FLOAT)
+    {
+        if (type.size == 4)
+        {
+            for (unsigned i = 0; i < BLOCK_ELEMENTS; i += 4)
+            {
+                const __m128 x = _mm_loadu_ps((const float*)a + i);
+                const __m128 y = _mm_loadu_ps((const float*)b + i);
+                *eq |= (uint64_t)_mm_movemask_ps(_mm_cmpeq_ps(x, y)) << i;
+                *gt |= (uint64_t)_mm_movemask_ps(_mm_cmpgt_ps(x, y)) << i;
+                *lt |= (uint64_t)_mm_movemask_ps(_mm_cmplt_ps(x, y)) << i;
+            }
+        }
+        else
+        {
+            for (unsigned i = 0; i < BLOCK_ELEMENTS; i += 2)
+            {
+                const __m128d x = _mm_loadu_pd((const double*)a + i);
+                const __m128d y = _mm_loadu_pd((const double*)b + i);
+                *eq |= (uint64_t)_mm_movemask_pd(_mm_cmpeq_pd(x, y)) << i;
+                *gt |= (uint64_t)_mm_movemask_pd(_mm_cmpgt_pd(x, y)) << i;
+                *lt |= (uint64_t)_mm_movemask_pd(_mm_cmplt_pd(x, y)) << i;
+            }
+        }
+        return;
+    }
+    
+    const bool is_unsigned = type.kind == RETRO_SCRIPT_MEMTYPE_UINT;
+    switch (type.size)
+    {
+    case 1:
+        compare_block_epi(a, b, 1, _mm_set1_epi8(is_unsigned ? (char)0x80 : 0), eq, gt, lt);
+        return;
+    case 2:
+        compare_block_epi(a, b, 2, _mm_set1_epi16(is_unsigned ? (short)0x8000 : 0), eq, gt, lt);
+        return;
+    case 4:
+        compare_block_epi(a, b, 4, _mm_set1_epi32(is_unsigned ? (int)0x80000000 : 0), eq, gt, lt);
+        return;
+    }
+    #endif
+    
+    // SSE2 has no 64-bit integer comparisons, so those always take this path.
+    #define COMPARE(ctype) \
+    { \
+        const ctype* x = (const ctype*)a; \
+        const ctype* y = (const ctype*)b; \
+        for (unsigned k = 0; k < BLOCK_ELEMENTS; ++k) \
+        { \
+            *eq |= (uint64_t)(x[k] == y[k]) << k; \
+            *gt |= (uint64_t)(x[k] > y[k]) << k; \
+            *lt |= (uint64_t)(x[k] < y[k]) << k; \
+        } \
+        return; \
+    }
+    switch (type.kind)
+    {
+    case RETRO_SCRIPT_MEMTYPE_INT:
+        switch (type.size)
+        {
+        case 1: COMPARE(int8_t);
+        case 2: COMPARE(int16_t);
+        case 4: COMPARE(int32_t);
+        case 8: COMPARE(int64_t);
+        }
+        break;
+    case RETRO_SCRIPT_MEMTYPE_UINT:
+        switch (type.size)
+        {
+        case 1: COMPARE(uint8_t);
+        case 2: COMPARE(uint16_t);
+        case 4: COMPARE(uint32_t);
+        case 8: COMPARE(uint64_t);
+        }
+        break;
+    case RETRO_SCRIPT_MEMTYPE_FLOAT:
+        switch (type.size)
+        {
+        case 4: COMPARE(float);
+        case 8: COMPARE(double);
+        }
+        break;
+    }
+    #undef COMPARE
+}
+
+// scratch = previous + delta, for all live candidates.
+// integers wrap around at the type's size.
+static void search_add_delta(ram_search_t* search, const void* delta)
+{
+    #define ADD(ctype) \
+    { \
+        ctype d; \
+        memcpy(&d, delta, sizeof(d)); \
+        const ctype* src = (const ctype*)search->previous; \
+        ctype* dst = (ctype*)search->scratch; \
+        for (size_t w = 0; w < search->num_words; ++w) \
+        { \
+            if (!search->candidates[w]) continue; \
+            for (size_t i = w * BLOCK_ELEMENTS; i < (w + 1) * BLOCK_ELEMENTS; ++i) \
+            { \
+                dst[i] = (ctype)(src[i] + d); \
+            } \
+        } \
+        return; \
+    }
+    if (search->type.kind == RETRO_SCRIPT_MEMTYPE_FLOAT)
+    {
+        switch (search->type.size)
+        {
+        case 4: ADD(float);
+        case 8: ADD(double);
+        }
+    }
+    else
+    {
+        switch (search->type.size)
+        {
+        case 1: ADD(uint8_t);
+        case 2: ADD(uint16_t);
+        case 4: ADD(uint32_t);
+        case 8: ADD(uint64_t);
+        }
+    }
+    #undef ADD
+}
+
+// removes all candidates which overlap the given byte offset in the range.
+static void search_drop_byte(ram_search_t* search, size_t offset)
+{
+    const size_t size = search->type.size;
+    size_t first = (offset + 1 >= size) ? (offset + 1 - size + search->step - 1) / search->step : 0;
+    for (size_t i = first; i <= offset / search->step && i < search->count; ++i)
+    {
+        search->candidates[i / BLOCK_ELEMENTS] &= ~((uint64_t)1 << (i % BLOCK_ELEMENTS));
+    }
+}
+
+static void search_read(ram_search_t* search)
+{
+    if (retro_script_memory_read_bytes(search->address, search->raw, search->size)) return;
+    
+    // some of the range is unmapped; find it and drop the candidates there.
+    for (size_t chunk = 0; chunk < search->size; chunk += READ_CHUNK_SIZE)
+    {
+        const size_t len = (search->size - chunk < READ_CHUNK_SIZE) ? search->size - chunk : READ_CHUNK_SIZE;
+        if (retro_script_memory_read_bytes(search->address + chunk, search->raw + chunk, len)) continue;
+        
+        for (size_t i = chunk; i < chunk + len; ++i)
+        {
+            if (!retro_script_memory_read_bytes(search->address + i, search->raw + i, 1))
+            {
+                search_drop_byte(search, i);
+            }
+        }
+    }
+}
+
+// the current values become the previous values, and current is read from memory.
+static void search_snapshot(ram_search_t* search)
+{
+    char* tmp = search->previous;
+    search->previous = search->current;
+    search->current = tmp;
+    
+    search_read(search);
+    
+    const size_t size = search->type.size;
+    if (search->step == size)
+    {
+        memcpy(search->current, search->raw, search->count * size);
+    }
+    else
+    {
+        for (size_t w = 0; w < search->num_words; ++w)
+        {
+            for (uint64_t bits = search->candidates[w]; bits; bits &= bits - 1)
+            {
+                const size_t i = w * BLOCK_ELEMENTS + retro_script_ctz64(bits);
+                memcpy(search->current + i * size, search->raw + i * search->step, size);
+            }
+        }
+    }
+    
+    retro_script_memtype_swap(search->type, search->current, search->count);
+}
+
+static void search_count(ram_search_t* search)
+{
+    search->remaining = 0;
+    for (size_t w = 0; w < search->num_words; ++w)
+    {
+        search->remaining += retro_script_popcount64(search->candidates[w]);
+    }
+}
+
+static void search_reset(ram_search_t* search)
+{
+    memset(search->candidates, 0xff, search->num_words * sizeof(uint64_t));
+    if (search->count % BLOCK_ELEMENTS)
+    {
+        search->candidates[search->num_words - 1] = ((uint64_t)1 << (search->count % BLOCK_ELEMENTS)) - 1;
+    }
+    search_snapshot(search);
+    search_count(search);
+}
+
+static void search_free(ram_search_t* search)
+{
+    free(search->candidates);
+    free(search->raw);
+    free(search->current);
+    free(search->previous);
+    free(search->scratch);
+    free(search);
+}
+
+// retrieves search from deepest elt on stack.
+// luaL_error is called on failure.
+static ram_search_t* get_search_from_self(lua_State* L)
+{
+    ram_search_t** search = (ram_search_t**)luaL_checkudata(L, 1, SEARCH_METATABLE);
+    if (!*search) _lua_error(L, "invalid 'self' argument (search has been freed).");
+    return *search;
+}
+
+// lua args: self, op, [value]
+//      ret: number of remaining candidates
+static int search_filter(lua_State* L)
+{
+    ram_search_t* search = get_search_from_self(L);
+    if (!lua_isstring(L, 2)) return _lua_error(L, "invalid search operation");
+    
+    const char* name = lua_tostring(L, 2);
+    size_t op_index;
+    for (op_index = 0; op_index < sizeof(search_ops) / sizeof(search_ops[0]); ++op_index)
+    {
+        if (strcmp(search_ops[op_index].name, name) == 0) break;
+    }
+    if (op_index >= sizeof(search_ops) / sizeof(search_ops[0])) return _lua_error(L, "invalid search operation");
+    const search_op op = search_ops[op_index].op;
+    
+    const bool has_value = lua_gettop(L) >= 3 && !lua_isnil(L, 3);
+    uint64_t value = 0;
+    if (has_value && (search_ops[op_index].relative || !retro_script_memtype_to(L, 3, search->type, &value)))
+    {
+        return _lua_error(L, "invalid value for search operation");
+    }
+    if (op == SEARCH_DELTA && !has_value) return _lua_error(L, "search operation \"delta\" requires a value");
+    
+    search_snapshot(search);
+    
+    // right-hand side of the comparison: the given value, or the previous snapshot (adjusted by delta).
+    const size_t block_size = BLOCK_ELEMENTS * search->type.size;
+    uint64_t block[BLOCK_ELEMENTS];
+    const char* rhs = search->previous;
+    size_t rhs_stride = block_size;
+    if (op == SEARCH_DELTA)
+    {
+        search_add_delta(search, &value);
+        rhs = search->scratch;
+    }
+    else if (has_value)
+    {
+        for (size_t k = 0; k < BLOCK_ELEMENTS; ++k)
+        {
+            memcpy((char*)block + k * search->type.size, &value, search->type.size);
+        }
+        rhs = (const char*)block;
+        rhs_stride = 0;
+    }
+    
+    search->remaining = 0;
+    for (size_t w = 0; w < search->num_words; ++w)
+    {
+        uint64_t c = search->candidates[w];
+        if (!c) continue;
+        
+        uint64_t eq, gt, lt;
+        compare_block(search->type, search->current + w * block_size, rhs + w * rhs_stride, &eq, &gt, &lt);
+        switch (op)
+        {
+        case SEARCH_EQ:
+        case SEARCH_DELTA:
+            c &= eq;
+            break;
+        case SEARCH_NE: c &= ~eq; break;
+        case SEARCH_LT: c &= lt; break;
+        case SEARCH_GT: c &= gt; break;
+        case SEARCH_LE: c &= lt | eq; break;
+        case SEARCH_GE: c &= gt | eq; break;
+        }
+        
+        search->candidates[w] = c;
+        search->remaining += retro_script_popcount64(c);
+    }
+    
+    lua_pushinteger(L, search->remaining);
+    return 1;
+}
+
+// lua args: self
+//      ret: number of remaining candidates
+static int search_update(lua_State* L)
+{
+    ram_search_t* search = get_search_from_self(L);
+    search_snapshot(search);
+    search_count(search);
+    lua_pushinteger(L, search->remaining);
+    return 1;
+}
+
+// lua args: self
+//      ret: number of remaining candidates
+static int search_reset_lua(lua_State* L)
+{
+    ram_search_t* search = get_search_from_self(L);
+    search_reset(search);
+    lua_pushinteger(L, search->remaining);
+    return 1;
+}
+
+// lua args: self
+//      ret: number of remaining candidates
+static int search_count_lua(lua_State* L)
+{
+    ram_search_t* search = get_search_from_self(L);
+    lua_pushinteger(L, search->remaining);
+    return 1;
+}
+
+// lua args: self, [max]
+//      ret: array of addresses, array of values (as of the latest snapshot)
+static int search_results(lua_State* L)
+{
+    ram_search_t* search = get_search_from_self(L);
+    size_t max = search->remaining;
+    if (lua_gettop(L) >= 2 && !lua_isnil(L, 2))
+    {
+        if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) < 0) return _lua_error(L, "invalid maximum for search results");
+        if ((size_t)lua_tointeger(L, 2) < max) max = lua_tointeger(L, 2);
+    }
+    
+    lua_createtable(L, max, 0);
+    lua_createtable(L, max, 0);
+    size_t n = 0;
+    for (size_t w = 0; w < search->num_words && n < max; ++w)
+    {
+        for (uint64_t bits = search->candidates[w]; bits && n < max; bits &= bits - 1)
+        {
+            const size_t i = w * BLOCK_ELEMENTS + retro_script_ctz64(bits);
+            ++n;
+            
+            lua_pushinteger(L, search->address + i * search->step);
+            lua_rawseti(L, -3, n);
+            
+            retro_script_memtype_push(L, search->type, search->current + i * search->type.size);
+            lua_rawseti(L, -2, n);
+        }
+    }
+    
+    return 2;
+}
+
+// lua args: self, key
+// the fields are read from the search; other keys are the methods (upvalue 1).
+static int search_index(lua_State* L)
+{
+    ram_search_t* search = get_search_from_self(L);
+    const char* key = lua_isstring(L, 2) ? lua_tostring(L, 2) : "";
+    if (!strcmp(key, "address"))
+    {
+        lua_pushinteger(L, search->address);
+    }
+    else if (!strcmp(key, "size"))
+    {
+        lua_pushinteger(L, search->size);
+    }
+    else if (!strcmp(key, "step"))
+    {
+        lua_pushinteger(L, search->step);
+    }
+    else
+    {
+        lua_settop(L, 2);
+        lua_rawget(L, lua_upvalueindex(1));
+    }
+    return 1;
+}
+
+// lua args: self
+// frees the search once the script no longer references it.
+static int search_gc(lua_State* L)
+{
+    ram_search_t** search = (ram_search_t**)luaL_checkudata(L, 1, SEARCH_METATABLE);
+    if (*search) search_free(*search);
+    *search = NULL;
+    return 0;
+}
+
+// sets the metatable shared by all of the script's searches (creating it if necessary) on the userdata at the top of the stack.
+static void set_search_metatable(lua_State* L)
+{
+    if (!luaL_getsubtable(L, LUA_REGISTRYINDEX, SEARCH_METATABLE))
+    {
+        #define FUNCFIELD(name, f) lua_pushcfunction(L, f); lua_rawsetfield(L, -2, #name);
+        
+        // methods
+        lua_newtable(L);
+        FUNCFIELD(filter, search_filter);
+        FUNCFIELD(update, search_update);
+        FUNCFIELD(reset, search_reset_lua);
+        FUNCFIELD(count, search_count_lua);
+        FUNCFIELD(results, search_results);
+        
+        lua_pushcclosure(L, search_index, 1);
+        lua_rawsetfield(L, -2, "__index");
+        FUNCFIELD(__gc, search_gc);
+        
+        #undef FUNCFIELD
+    }
+    lua_setmetatable(L, -2);
+}
+
+int retro_script_luafunc_memory_search(lua_State* L)
+{
+    // validate args
+    retro_script_memtype_t type;
+    if (!retro_script_memtype_parse_lua(L, 1, 4, &type)) return _lua_error(L, "invalid type for \"search\"");
+    if (!lua_isinteger(L, 2) || !lua_isinteger(L, 3)) return _lua_error(L, "invalid arguments to \"search\"");
+    lua_Integer address = lua_tointeger(L, 2);
+    lua_Integer size = lua_tointeger(L, 3);
+    lua_Integer step = type.size;
+    if (lua_gettop(L) >= 5 && !lua_isnil(L, 5))
+    {
+        if (!lua_isinteger(L, 5)) return _lua_error(L, "invalid step for \"search\"");
+        step = lua_tointeger(L, 5);
+    }
+    if (address < 0 || size < type.size || step <= 0) return _lua_error(L, "invalid arguments to \"search\"");
+    
+    // the userdata holds the search, which is freed when the userdata is collected.
+    ram_search_t** ud = (ram_search_t**)lua_newuserdatauv(L, sizeof(ram_search_t*), 0);
+    *ud = NULL;
+    set_search_metatable(L);
+    
+    ram_search_t* search = alloc(ram_search_t);
+    if (!search) return _lua_error(L, "unable to allocate search");
+    *ud = search;
+    
+    memset(search, 0, sizeof(*search));
+    search->type = type;
+    search->address = address;
+    search->size = size;
+    search->step = step;
+    search->count = (size - type.size) / step + 1;
+    search->num_words = (search->count + BLOCK_ELEMENTS - 1) / BLOCK_ELEMENTS;
+    
+    const size_t values_size = search->num_words * BLOCK_ELEMENTS * type.size;
+    search->candidates = malloc_array(uint64_t, search->num_words);
+    search->raw = malloc_array(char, search->size);
+    search->current = calloc(values_size, 1);
+    search->previous = calloc(values_size, 1);
+    search->scratch = calloc(values_size, 1);
+    if (!search->candidates || !search->raw || !search->current || !search->previous || !search->scratch)
+    {
+        return _lua_error(L, "unable to allocate search");
+    }
+    
+    search_reset(search);
+    return 1;
+}
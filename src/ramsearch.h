@@ -0,0 +1,7 @@
+#pragma once
+
+#include "script.h"
+
+// lua args: type, address, size, [endian], [step]
+//      ret: search (a userdata)
+int retro_script_luafunc_memory_search(struct lua_State* L);
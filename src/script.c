@@ -1,5 +1,14 @@
 #include "script_luafuncs.h"
 #include "hc_hooks.h"
+#include "memview.h"
+#include "ramsearch.h"
+#include "memsnapshot.h"
+#include "memfreeze.h"
+#include "memfind.h"
+#include "memstruct.h"
+#include "memjournal.h"
+#include "memtrigger.h"
+#include "memexport.h"
 
 #include "libretro_script.h"
 #include "script.h"
@@ -224,6 +233,27 @@ void retro_script_register_retro_global(lua_State* L)
     REGISTER_FUNC("write_char", retro_script_luafunc_memory_write_char);
     REGISTER_FUNC("read_byte", retro_script_luafunc_memory_read_byte);
     REGISTER_FUNC("write_byte", retro_script_luafunc_memory_write_byte);
+    REGISTER_FUNC("read_bytes", retro_script_luafunc_memory_read_bytes);
+    REGISTER_FUNC("write_bytes", retro_script_luafunc_memory_write_bytes);
+    REGISTER_FUNC("read_array", retro_script_luafunc_memory_read_array);
+    REGISTER_FUNC("write_array", retro_script_luafunc_memory_write_array);
+    REGISTER_FUNC("read_bits", retro_script_luafunc_memory_read_bits);
+    REGISTER_FUNC("write_bits", retro_script_luafunc_memory_write_bits);
+    REGISTER_FUNC("view", retro_script_luafunc_memory_view);
+    REGISTER_FUNC("search", retro_script_luafunc_memory_search);
+    REGISTER_FUNC("snapshot_frames", retro_script_luafunc_snapshot_frames);
+    REGISTER_FUNC("frame_diff", retro_script_luafunc_frame_diff);
+    REGISTER_FUNC("freeze", retro_script_luafunc_memory_freeze);
+    REGISTER_FUNC("unfreeze", retro_script_luafunc_memory_unfreeze);
+    REGISTER_FUNC("find", retro_script_luafunc_memory_find);
+    REGISTER_FUNC("struct", retro_script_luafunc_memory_struct);
+    REGISTER_FUNC("defer_writes", retro_script_luafunc_defer_writes);
+    REGISTER_FUNC("write_log", retro_script_luafunc_write_log);
+    REGISTER_FUNC("on_change", retro_script_luafunc_on_change);
+    REGISTER_FUNC("on_value", retro_script_luafunc_on_value);
+    REGISTER_FUNC("remove_trigger", retro_script_luafunc_remove_trigger);
+    REGISTER_FUNC("export_memory", retro_script_luafunc_export_memory);
+    REGISTER_FUNC("unexport_memory", retro_script_luafunc_unexport_memory);
 
     REGISTER_MEMORY_ACCESS(int16);
     REGISTER_MEMORY_ACCESS(uint16);
@@ -247,6 +277,7 @@ void retro_script_register_retro_global(lua_State* L)
         REGISTER_FUNC("system_get_breakpoints", retro_script_luafunc_hc_system_get_breakpoints);
         REGISTER_FUNC("system_get_cpus", retro_script_luafunc_hc_system_get_cpus);
         REGISTER_FUNC("breakpoint_clear", retro_script_luafunc_hc_breakpoint_clear);
+        REGISTER_FUNC("defer_events", retro_script_luafunc_hc_defer_events);
 
         retro_script_luafield_hc_main_cpu_and_memory(L);
 
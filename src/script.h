@@ -4,6 +4,8 @@
 
 struct lua_State;
 struct lua_ram;
+struct memory_view;
+struct ram_search;
 
 typedef struct script_state
 {
@@ -21,6 +23,16 @@ typedef struct script_state
     
     // extra serializeable ram.
     struct lua_ram* lram;
+    
+    // whether memory snapshots should be taken around each frame.
+    bool snapshot_frames;
+    
+    // whether writes from on_run_begin are deferred until just before the frame runs.
+    bool defer_writes;
+    
+    // whether hc watchpoint events are queued and passed to lua once the frame has run, and how many are kept.
+    bool defer_hc_events;
+    size_t hc_event_capacity;
 } script_state_t;
 
 void retro_script_execute_cb(script_state_t*, int ref);
@@ -2,6 +2,14 @@
 #include "script_list.h"
 #include "util.h"
 #include "lram.h"
+#include "memview.h"
+#include "ramsearch.h"
+#include "memfreeze.h"
+#include "memstruct.h"
+#include "memtrigger.h"
+#include "memexport.h"
+#include "hc_luafuncs.h"
+#include "hc_trace.h"
 
 #include <stdio.h>
 
@@ -114,6 +122,11 @@ bool script_free(retro_script_id_t id)
         }
         
         retro_script_free_lram(script);
+        retro_script_free_freezes(script);
+        retro_script_free_triggers(script);
+        retro_script_free_exports(script);
+        retro_script_hc_free_events(script);
+        retro_script_hc_free_traces(script);
         lua_close(script->L);
         free(script);
         
@@ -1,10 +1,13 @@
 #include "l.h"
 #include "script_luafuncs.h"
 #include "memmap.h"
+#include "memjournal.h"
 #include "core.h"
 #include "script.h"
 #include "script_list.h"
 #include "lram.h"
+#include "memtype.h"
+#include "bswap.h"
 
 int retro_script_luafunc_input_poll(lua_State* L)
 {
@@ -245,16 +248,29 @@ void retro_script_luafield_constants(struct lua_State* L)
 #undef REGISTER_INT_MACRO
 }
 
+// retrieves the optional addrspace argument: NULL if absent or nil.
+// returns false if the argument is not a string.
+static bool get_addrspace_arg(lua_State* L, int idx, const char** addrspace)
+{
+    *addrspace = NULL;
+    if (lua_gettop(L) < idx || lua_isnil(L, idx)) return true;
+    if (!lua_isstring(L, idx)) return false;
+    *addrspace = lua_tostring(L, idx);
+    return true;
+}
+
+// lua args: address, [addrspace]
 int retro_script_luafunc_memory_read_char(lua_State* L)
 {
+    const char* addrspace;
     int n = lua_gettop(L);
-    if (n > 0 && lua_isinteger(L, -1))
+    if (n >= 1 && lua_isinteger(L, 1) && get_addrspace_arg(L, 2, &addrspace))
     {
-        lua_Integer addr = lua_tointeger(L, -1);
+        lua_Integer addr = lua_tointeger(L, 1);
         if (addr < 0) return 0; // invalid usage
         
         char out;
-        if (retro_script_memory_read_char(addr, &out))
+        if (retro_script_journal_read_bytes_in(addrspace, addr, &out, 1))
         {
             lua_pushinteger(L, out);
             return 1;
@@ -271,16 +287,18 @@ int retro_script_luafunc_memory_read_char(lua_State* L)
     }
 }
 
+// lua args: address, [addrspace]
 int retro_script_luafunc_memory_read_byte(lua_State* L)
 {
+    const char* addrspace;
     int n = lua_gettop(L);
-    if (n >= 1 && lua_isinteger(L, -1))
+    if (n >= 1 && lua_isinteger(L, 1) && get_addrspace_arg(L, 2, &addrspace))
     {
-        lua_Integer addr = lua_tointeger(L, -1);
+        lua_Integer addr = lua_tointeger(L, 1);
         if (addr < 0) return 0; // invalid usage
         
         unsigned char out;
-        if (retro_script_memory_read_byte(addr, &out))
+        if (retro_script_journal_read_bytes_in(addrspace, addr, &out, 1))
         {
             lua_pushinteger(L, out);
             return 1;
@@ -297,17 +315,19 @@ int retro_script_luafunc_memory_read_byte(lua_State* L)
     }
 }
 
+// lua args: address, value, [addrspace]
 int retro_script_luafunc_memory_write_char(lua_State* L)
 {
+    const char* addrspace;
     int n = lua_gettop(L);
-    if (n >= 2 && lua_isinteger(L, -1) && lua_isinteger(L, -2))
+    if (n >= 2 && lua_isinteger(L, 1) && lua_isinteger(L, 2) && get_addrspace_arg(L, 3, &addrspace))
     {
-        lua_Integer addr = lua_tointeger(L, -2);
+        lua_Integer addr = lua_tointeger(L, 1);
         if (addr < 0) return 0; // invalid usage
         
-        char in = lua_tointeger(L, -1);
+        char in = lua_tointeger(L, 2);
         lua_pushinteger(L,
-            retro_script_memory_write_char(addr, in)
+            retro_script_journal_write_bytes_in(addrspace, addr, &in, 1)
         );
         
         return 1;
@@ -319,17 +339,19 @@ int retro_script_luafunc_memory_write_char(lua_State* L)
     }
 }
 
+// lua args: address, value, [addrspace]
 int retro_script_luafunc_memory_write_byte(lua_State* L)
 {
+    const char* addrspace;
     int n = lua_gettop(L);
-    if (n >= 2 && lua_isinteger(L, -1) && lua_isinteger(L, -2))
+    if (n >= 2 && lua_isinteger(L, 1) && lua_isinteger(L, 2) && get_addrspace_arg(L, 3, &addrspace))
     {
-        lua_Integer addr = lua_tointeger(L, -2);
+        lua_Integer addr = lua_tointeger(L, 1);
         if (addr < 0) return 0; // invalid usage
         
-        unsigned char in = lua_tointeger(L, -1);
+        unsigned char in = lua_tointeger(L, 2);
         lua_pushinteger(L,
-            retro_script_memory_write_byte(addr, in)
+            retro_script_journal_write_bytes_in(addrspace, addr, &in, 1)
         );
         
         return 1;
@@ -341,21 +363,216 @@ int retro_script_luafunc_memory_write_byte(lua_State* L)
     }
 }
 
+// lua args: address, length, [addrspace]
+//      ret: string, or nil if any byte is unmapped
+int retro_script_luafunc_memory_read_bytes(lua_State* L)
+{
+    const char* addrspace;
+    int n = lua_gettop(L);
+    if (n >= 2 && lua_isinteger(L, 1) && lua_isinteger(L, 2) && get_addrspace_arg(L, 3, &addrspace))
+    {
+        lua_Integer addr = lua_tointeger(L, 1);
+        lua_Integer len = lua_tointeger(L, 2);
+        if (addr < 0 || len < 0) return 0; // invalid usage
+        
+        char stackbuff[256];
+        char* buff = ((size_t)len <= sizeof(stackbuff)) ? stackbuff : malloc(len);
+        if (!buff) return _lua_error(L, "unable to allocate buffer for \"read_bytes\"");
+        
+        const bool success = retro_script_journal_read_bytes_in(addrspace, addr, buff, len);
+        if (success)
+        {
+            lua_pushlstring(L, buff, len);
+        }
+        
+        if (buff != stackbuff) free(buff);
+        return success ? 1 : 0;
+    }
+    else
+    {
+        // invalid usage.
+        return 0;
+    }
+}
+
+// lua args: address, string, [addrspace]
+//      ret: 1 if written, 0 if any byte is unmapped or const
+int retro_script_luafunc_memory_write_bytes(lua_State* L)
+{
+    const char* addrspace;
+    int n = lua_gettop(L);
+    if (n >= 2 && lua_isinteger(L, 1) && lua_isstring(L, 2) && get_addrspace_arg(L, 3, &addrspace))
+    {
+        lua_Integer addr = lua_tointeger(L, 1);
+        if (addr < 0) return 0; // invalid usage
+        
+        size_t len;
+        const char* data = lua_tolstring(L, 2, &len);
+        lua_pushinteger(L,
+            retro_script_journal_write_bytes_in(addrspace, addr, data, len)
+        );
+        
+        return 1;
+    }
+    else
+    {
+        // invalid usage.
+        return 0;
+    }
+}
+
+// lua args: type, address, count, [endian], [addrspace]
+//      ret: table of values, or nil if any byte is unmapped
+int retro_script_luafunc_memory_read_array(lua_State* L)
+{
+    retro_script_memtype_t type;
+    const char* addrspace;
+    if (lua_gettop(L) < 3 || !retro_script_memtype_parse_lua(L, 1, 4, &type))
+        return _lua_error(L, "invalid type for \"read_array\"");
+    if (!lua_isinteger(L, 2) || !lua_isinteger(L, 3) || !get_addrspace_arg(L, 5, &addrspace)) return 0; // invalid usage
+    
+    lua_Integer addr = lua_tointeger(L, 2);
+    lua_Integer count = lua_tointeger(L, 3);
+    if (addr < 0 || count < 0 || (size_t)count > SIZE_MAX / type.size || count > INT32_MAX) return 0; // invalid usage
+    
+    const size_t size = (size_t)count * type.size;
+    char stackbuff[256];
+    char* buff = (size <= sizeof(stackbuff)) ? stackbuff : malloc(size);
+    if (!buff) return _lua_error(L, "unable to allocate buffer for \"read_array\"");
+    
+    const bool success = retro_script_journal_read_bytes_in(addrspace, addr, buff, size);
+    if (success)
+    {
+        // decode the whole array in one pass.
+        retro_script_memtype_swap(type, buff, count);
+        
+        lua_createtable(L, count, 0);
+        for (lua_Integer i = 0; i < count; ++i)
+        {
+            retro_script_memtype_push(L, type, buff + i * type.size);
+            lua_rawseti(L, -2, i + 1);
+        }
+    }
+    
+    if (buff != stackbuff) free(buff);
+    return success ? 1 : 0;
+}
+
+// lua args: type, address, values, [endian], [addrspace]
+//      ret: 1 if written, 0 if any byte is unmapped or const
+int retro_script_luafunc_memory_write_array(lua_State* L)
+{
+    retro_script_memtype_t type;
+    const char* addrspace;
+    if (lua_gettop(L) < 3 || !retro_script_memtype_parse_lua(L, 1, 4, &type))
+        return _lua_error(L, "invalid type for \"write_array\"");
+    if (!lua_isinteger(L, 2) || !lua_istable(L, 3) || !get_addrspace_arg(L, 5, &addrspace)) return 0; // invalid usage
+    
+    lua_Integer addr = lua_tointeger(L, 2);
+    if (addr < 0) return 0; // invalid usage
+    
+    const size_t count = lua_rawlen(L, 3);
+    if (count > SIZE_MAX / type.size) return 0;
+    
+    const size_t size = count * type.size;
+    char stackbuff[256];
+    char* buff = (size <= sizeof(stackbuff)) ? stackbuff : malloc(size);
+    if (!buff) return _lua_error(L, "unable to allocate buffer for \"write_array\"");
+    
+    for (size_t i = 0; i < count; ++i)
+    {
+        lua_rawgeti(L, 3, i + 1);
+        const bool valid = retro_script_memtype_to(L, -1, type, buff + i * type.size);
+        lua_pop(L, 1);
+        if (!valid)
+        {
+            if (buff != stackbuff) free(buff);
+            return _lua_error(L, "invalid value in array for \"write_array\"");
+        }
+    }
+    
+    // encode the whole array in one pass.
+    retro_script_memtype_swap(type, buff, count);
+    const bool success = retro_script_journal_write_bytes_in(addrspace, addr, buff, size);
+    
+    if (buff != stackbuff) free(buff);
+    lua_pushinteger(L, success);
+    return 1;
+}
+
+// retrieves the optional endianness argument ("le" or "be"; default little-endian).
+static bool get_endian_arg(lua_State* L, int idx, bool* big_endian)
+{
+    *big_endian = false;
+    if (lua_gettop(L) < idx || lua_isnil(L, idx)) return true;
+    if (!lua_isstring(L, idx)) return false;
+    
+    const char* endian = lua_tostring(L, idx);
+    if (strcmp(endian, "be") == 0) *big_endian = true;
+    else if (strcmp(endian, "le") != 0) return false;
+    return true;
+}
+
+// lua args: address, bit offset, width, [endian], [addrspace]
+//      ret: unsigned value of the bitfield, or nil if unmapped
+int retro_script_luafunc_memory_read_bits(lua_State* L)
+{
+    bool big_endian;
+    const char* addrspace;
+    if (!lua_isinteger(L, 1) || lua_tointeger(L, 1) < 0) return 0; // invalid usage
+    if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) < 0) return _lua_error(L, "invalid bit offset for \"read_bits\"");
+    if (!lua_isinteger(L, 3) || lua_tointeger(L, 3) < 1 || lua_tointeger(L, 3) > 64) return _lua_error(L, "invalid width for \"read_bits\"");
+    if (!get_endian_arg(L, 4, &big_endian)) return _lua_error(L, "invalid endianness for \"read_bits\"");
+    if (!get_addrspace_arg(L, 5, &addrspace)) return 0; // invalid usage
+    
+    uint64_t value;
+    if (!retro_script_journal_read_bits_in(addrspace, lua_tointeger(L, 1), lua_tointeger(L, 2), lua_tointeger(L, 3), big_endian, &value)) return 0;
+    
+    lua_pushinteger(L, (lua_Integer)value);
+    return 1;
+}
+
+// lua args: address, bit offset, width, value, [endian], [addrspace]
+//      ret: 1 if written, 0 if unmapped or const
+int retro_script_luafunc_memory_write_bits(lua_State* L)
+{
+    bool big_endian;
+    const char* addrspace;
+    if (!lua_isinteger(L, 1) || lua_tointeger(L, 1) < 0) return 0; // invalid usage
+    if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) < 0) return _lua_error(L, "invalid bit offset for \"write_bits\"");
+    if (!lua_isinteger(L, 3) || lua_tointeger(L, 3) < 1 || lua_tointeger(L, 3) > 64) return _lua_error(L, "invalid width for \"write_bits\"");
+    if (!lua_isinteger(L, 4)) return _lua_error(L, "invalid value for \"write_bits\"");
+    if (!get_endian_arg(L, 5, &big_endian)) return _lua_error(L, "invalid endianness for \"write_bits\"");
+    if (!get_addrspace_arg(L, 6, &addrspace)) return 0; // invalid usage
+    
+    lua_pushinteger(L,
+        retro_script_journal_write_bits_in(addrspace, lua_tointeger(L, 1), lua_tointeger(L, 2), lua_tointeger(L, 3), big_endian, (uint64_t)lua_tointeger(L, 4))
+    );
+    return 1;
+}
+
 #define DEFINE_LUAFUNCS_MEMORY_ACCESS(type, ctype, luatype) \
     DEFINE_LUAFUNCS_MEMORY_ACCESS_ENDIAN(type, ctype, luatype, le) \
     DEFINE_LUAFUNCS_MEMORY_ACCESS_ENDIAN(type, ctype, luatype, be)
 
+static const int be = 0;
+static const int le = 1;
+
+// lua args (read): address, [addrspace]
+// lua args (write): address, value, [addrspace]
 #define DEFINE_LUAFUNCS_MEMORY_ACCESS_ENDIAN(type, ctype, luatype, le) \
 int retro_script_luafunc_memory_read_##type##_##le(lua_State* L) \
 { \
+    const char* addrspace; \
     int n = lua_gettop(L); \
-    if (n >= 1 && lua_isinteger(L, -1)) \
+    if (n >= 1 && lua_isinteger(L, 1) && get_addrspace_arg(L, 2, &addrspace)) \
     { \
-        lua_Integer addr = lua_tointeger(L, -1); \
+        lua_Integer addr = lua_tointeger(L, 1); \
         if (addr < 0) return 0; \
         ctype out; \
-        if (retro_script_memory_read_##type##_##le(addr, &out)) \
+        if (retro_script_journal_read_bytes_in(addrspace, addr, &out, sizeof(out))) \
         { \
+            if (le == SYS_IS_BIGENDIAN) retro_script_bswap_value(&out, sizeof(out)); \
             lua_push##luatype(L, out); \
             return 1; \
         } \
@@ -364,14 +581,16 @@ int retro_script_luafunc_memory_read_##type##_##le(lua_State* L) \
 } \
 int retro_script_luafunc_memory_write_##type##_##le(lua_State* L) \
 { \
+    const char* addrspace; \
     int n = lua_gettop(L); \
-    if (n >= 2 && lua_isinteger(L, -2) && lua_is##luatype(L, -1)) \
+    if (n >= 2 && lua_isinteger(L, 1) && lua_is##luatype(L, 2) && get_addrspace_arg(L, 3, &addrspace)) \
     { \
-        lua_Integer addr = lua_tointeger(L, -2); \
+        lua_Integer addr = lua_tointeger(L, 1); \
         if (addr < 0) return 0; \
-        ctype in = lua_to##luatype(L, -1); \
+        ctype in = lua_to##luatype(L, 2); \
+        if (le == SYS_IS_BIGENDIAN) retro_script_bswap_value(&in, sizeof(in)); \
         lua_pushinteger(L, \
-            retro_script_memory_write_##type##_##le(addr, in) \
+            retro_script_journal_write_bytes_in(addrspace, addr, &in, sizeof(in)) \
         ); \
         return 1; \
     } \
@@ -9,6 +9,12 @@ int retro_script_luafunc_memory_read_char(struct lua_State* L);
 int retro_script_luafunc_memory_read_byte(struct lua_State* L);
 int retro_script_luafunc_memory_write_char(struct lua_State* L);
 int retro_script_luafunc_memory_write_byte(struct lua_State* L);
+int retro_script_luafunc_memory_read_bytes(struct lua_State* L);
+int retro_script_luafunc_memory_write_bytes(struct lua_State* L);
+int retro_script_luafunc_memory_read_array(struct lua_State* L);
+int retro_script_luafunc_memory_write_array(struct lua_State* L);
+int retro_script_luafunc_memory_read_bits(struct lua_State* L);
+int retro_script_luafunc_memory_write_bits(struct lua_State* L);
 
 #define DECLARE_LUAFUNCS_MEMORY_ACCESS(type, ctype, luatype) \
     DECLARE_LUAFUNCS_MEMORY_ACCESS_ENDIAN(type, ctype, luatype, le) \
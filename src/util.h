@@ -6,6 +6,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #ifdef RETRO_SCRIPT_DEBUG
 // we include debug.h to allow gdb access from most files,
@@ -86,6 +87,35 @@ FORCEINLINE void retro_script_split_path_file(char** p, char** f, const char *pf
     *p = retro_script_strndup(pf, slash - pf);
 }
 
+// number of set bits.
+static FORCEINLINE unsigned retro_script_popcount64(uint64_t x)
+{
+    #if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_popcountll(x);
+    #else
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (unsigned)((x * 0x0101010101010101ull) >> 56);
+    #endif
+}
+
+// index of lowest set bit. x must be nonzero.
+static FORCEINLINE unsigned retro_script_ctz64(uint64_t x)
+{
+    #if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctzll(x);
+    #else
+    unsigned n = 0;
+    while (!(x & 1))
+    {
+        x >>= 1;
+        ++n;
+    }
+    return n;
+    #endif
+}
+
 struct lua_State;
 
 // like lua_rawgetfield, but bypasses metatable